@@ -0,0 +1,54 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+// per instance (must match instance_data in src/main.c): xy = offset, z = scale, w = rotation
+layout(location = 2) in vec4 inTransform;
+layout(location = 3) in vec4 inTint;
+
+layout(location = 0) out vec3 fragColor;
+// (shader.frag wants these too, but instances are never textured)
+layout(location = 1) out vec2 fragUV;
+layout(location = 2) flat out uint fragTexture;
+
+// the depth prepass pipeline runs this same shader, so its depth has to come out bit-for-bit
+// identical for the EQUAL test in the color pass:
+invariant gl_Position;
+
+// Per-frame uniforms, must match frame_uniforms in src/main.c:
+layout(std140, set = 1, binding = 0) uniform Frame {
+    vec2 cameraCenter;
+    float cameraZoom;
+    float time;
+    // bindless image slot per streamed texture, four to a uvec4 (MAX_TEXTURES / 4 of them)
+    uvec4 textureSlots[16];
+} frame;
+
+// Specialization constants (see shader_specialization in src/main.c):
+layout(constant_id = 0) const bool DEBUG_OBJECTS = false;
+
+// a stable, distinct-ish color per object for the DEBUG_OBJECTS view:
+vec3 indexColor(uint index) {
+    uint h = index * 2654435761u;
+    return vec3(h & 255u, (h >> 8) & 255u, (h >> 16) & 255u) / 255.0;
+}
+
+// Reverse-Z depth (1 = near, 0 = far) for the index'th object: each one sits in front of everything
+// drawn after it, so drawing in index order is drawing front-to-back and early depth testing can
+// throw away the fragments of everything behind.
+float objectDepth(uint index) {
+    return 1.0 / float(index + 1u);
+}
+
+void main() {
+    float s = sin(inTransform.w);
+    float c = cos(inTransform.w);
+    vec2 position = mat2(c, s, -s, c) * inPosition * inTransform.z;
+    vec2 world = inTransform.xy + position;
+    gl_Position = vec4((world - frame.cameraCenter) * frame.cameraZoom,
+                       objectDepth(uint(gl_InstanceIndex)), 1.0);
+    fragColor = DEBUG_OBJECTS ? indexColor(uint(gl_InstanceIndex)) : inColor * inTint.rgb;
+    fragUV = inPosition + 0.5;
+    fragTexture = 0xffffffffu;
+}
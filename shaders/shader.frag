@@ -1,9 +1,32 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Specialization constants (see shader_specialization in src/main.c):
+layout(constant_id = 1) const bool ENCODE_SRGB = false;
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUV;
+// a slot in the bindless set's images, or 0xffffffff for untextured
+layout(location = 2) flat in uint fragTexture;
 
 layout(location = 0) out vec4 outColor;
 
+// The bindless set's images (see vk_init_bindless in src/main.c).  Which slot a texture is in
+// changes as its mips are streamed in and out, so it comes from the per-frame uniforms:
+layout(set = 0, binding = 1) uniform sampler2D textures[];
+
+vec3 linearToSrgb(vec3 color) {
+    vec3 low = color * 12.92;
+    vec3 high = 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055;
+    return mix(low, high, step(vec3(0.0031308), color));
+}
+
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    vec3 color = fragColor;
+    if (fragTexture != 0xffffffffu) {
+        // fragTexture is flat but differs between draws (and so within a subgroup), hence
+        // nonuniformEXT:
+        color *= texture(textures[nonuniformEXT(fragTexture)], fragUV).rgb;
+    }
+    outColor = vec4(ENCODE_SRGB ? linearToSrgb(color) : color, 1.0);
 }
@@ -1,20 +1,76 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
 
 layout(location = 0) out vec3 fragColor;
+// where on the mesh we are (0..1 across its bounds) and the bindless slot to sample, if any:
+layout(location = 1) out vec2 fragUV;
+layout(location = 2) flat out uint fragTexture;
+
+// the depth prepass pipeline runs this same shader, so its depth has to come out bit-for-bit
+// identical for the EQUAL test in the color pass:
+invariant gl_Position;
+
+// Must match gpu_object in src/main.c:
+struct Object {
+    vec2 center;
+    float scale;
+    float radius;
+    uint indexCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint texture;
+};
+
+// The bindless set's storage buffers (see vk_init_bindless in src/main.c).  Every buffer in the
+// array gets declared with the same block, so this view of it only makes sense for gpu_objects:
+layout(std430, set = 0, binding = 0) readonly buffer Objects {
+    Object objects[];
+} buffers[];
+
+// Must match draw_push_constants in src/main.c:
+layout(push_constant) uniform PushConstants {
+    uint objectBuffer;
+} pc;
 
-vec2 positions[3] = vec2[](
-        vec2(0.0, -0.5),
-        vec2(0.5, 0.5),
-        vec2(-0.5, 0.5)
-    );
+// Per-frame uniforms, must match frame_uniforms in src/main.c:
+layout(std140, set = 1, binding = 0) uniform Frame {
+    vec2 cameraCenter;
+    float cameraZoom;
+    float time;
+    // bindless image slot per streamed texture, four to a uvec4 (MAX_TEXTURES / 4 of them)
+    uvec4 textureSlots[16];
+} frame;
+
+// Specialization constants (see shader_specialization in src/main.c):
+layout(constant_id = 0) const bool DEBUG_OBJECTS = false;
+
+// a stable, distinct-ish color per object for the DEBUG_OBJECTS view:
+vec3 indexColor(uint index) {
+    uint h = index * 2654435761u;
+    return vec3(h & 255u, (h >> 8) & 255u, (h >> 16) & 255u) / 255.0;
+}
+
+// Reverse-Z depth (1 = near, 0 = far) for the index'th object: each one sits in front of everything
+// drawn after it, so drawing in index order is drawing front-to-back and early depth testing can
+// throw away the fragments of everything behind.
+float objectDepth(uint index) {
+    return 1.0 / float(index + 1u);
+}
 
-vec3 colors[3] = vec3[](
-        vec3(1.0, 0.0, 0.0),
-        vec3(0.0, 1.0, 0.0),
-        vec3(0.0, 0.0, 1.0)
-    );
+const uint NO_TEXTURE = 0xffffffffu;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    // every draw passes its object's index as firstInstance:
+    Object object = buffers[pc.objectBuffer].objects[gl_InstanceIndex];
+    vec2 world = object.center + inPosition * object.scale;
+    gl_Position = vec4((world - frame.cameraCenter) * frame.cameraZoom,
+                       objectDepth(uint(gl_InstanceIndex)), 1.0);
+    fragColor = DEBUG_OBJECTS ? indexColor(uint(gl_InstanceIndex)) : inColor;
+    fragUV = inPosition + 0.5;
+    fragTexture = object.texture == NO_TEXTURE || DEBUG_OBJECTS
+                      ? NO_TEXTURE
+                      : frame.textureSlots[object.texture / 4u][object.texture % 4u];
 }
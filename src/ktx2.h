@@ -0,0 +1,113 @@
+#pragma once
+
+// The parts of the KTX2 container (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html)
+// that the texture streamer reads: the header and the level index, which says where each mip level
+// is in the file.  Everything is little endian.
+//
+//     ktx2_header
+//     ktx2_level[max(header.level_count, 1)]
+//     data format descriptor, key/value data, supercompression data (all ignored)
+//     mip levels, smallest first
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define KTX2_IDENTIFIER_SIZE 12
+// 2D textures can't have more levels than this (a 2^15 x 2^15 image has 16), so the streamer can
+// keep per-level things in fixed size arrays:
+#define KTX2_MAX_LEVELS 16
+
+static const uint8_t ktx2_identifier[KTX2_IDENTIFIER_SIZE] = {
+    0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n',
+};
+
+enum
+{
+    KTX2_SUPERCOMPRESSION_NONE = 0,
+};
+
+typedef struct ktx2_header
+{
+    uint8_t identifier[KTX2_IDENTIFIER_SIZE];
+    // a VkFormat, or 0 (VK_FORMAT_UNDEFINED) for basis universal, which we don't do
+    uint32_t vk_format;
+    uint32_t type_size;
+    uint32_t pixel_width;
+    uint32_t pixel_height;
+    uint32_t pixel_depth;
+    uint32_t layer_count;
+    uint32_t face_count;
+    // 0 means "generate the mips yourself", and the file only has level 0
+    uint32_t level_count;
+    uint32_t supercompression_scheme;
+    uint32_t dfd_byte_offset;
+    uint32_t dfd_byte_length;
+    uint32_t kvd_byte_offset;
+    uint32_t kvd_byte_length;
+    uint64_t sgd_byte_offset;
+    uint64_t sgd_byte_length;
+} ktx2_header;
+
+// Where one mip level is, level 0 (the biggest) first:
+typedef struct ktx2_level
+{
+    // from the start of the file, in bytes
+    uint64_t byte_offset;
+    uint64_t byte_length;
+    // same as byte_length without supercompression
+    uint64_t uncompressed_byte_length;
+} ktx2_level;
+
+static_assert(sizeof(ktx2_header) == 80, "ktx2_header layout changed");
+static_assert(sizeof(ktx2_level) == 24, "ktx2_level layout changed");
+
+// Checks that `data` is a KTX2 file whose header and level index are in bounds, that it doesn't
+// claim more levels than its size allows, and that every level it points at is in bounds too.
+// Doesn't look at the format at all, so whether the levels are big enough is up to the caller.
+static inline bool ktx2_valid(const void *data, size_t size)
+{
+    if (size < sizeof(ktx2_header))
+    {
+        return false;
+    }
+    const ktx2_header *header = data;
+    if (memcmp(header->identifier, ktx2_identifier, KTX2_IDENTIFIER_SIZE) != 0)
+    {
+        return false;
+    }
+
+    // (height and depth are 0 for 1D and 2D textures, but width never is)
+    if (header->pixel_width == 0)
+    {
+        return false;
+    }
+    // a full mip chain goes down to 1x1, so it has floor(log2(biggest side)) + 1 levels:
+    uint32_t biggest = header->pixel_width;
+    biggest = header->pixel_height > biggest ? header->pixel_height : biggest;
+    biggest = header->pixel_depth > biggest ? header->pixel_depth : biggest;
+    uint32_t max_levels = 1;
+    while (biggest >>= 1)
+    {
+        max_levels++;
+    }
+
+    uint32_t level_count = header->level_count > 0 ? header->level_count : 1;
+    if (level_count > max_levels || level_count > KTX2_MAX_LEVELS ||
+        size < sizeof(ktx2_header) + level_count * sizeof(ktx2_level))
+    {
+        return false;
+    }
+
+    const ktx2_level *levels = (const ktx2_level *)(header + 1);
+    for (uint32_t i = 0; i < level_count; i++)
+    {
+        if (levels[i].byte_offset > size || levels[i].byte_length > size - levels[i].byte_offset)
+        {
+            return false;
+        }
+    }
+    return true;
+}
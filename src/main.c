@@ -1,21 +1,44 @@
 #include "SDL2/SDL_video.h"
+#include "ktx2.h"
+#include "shader_pack.h"
 #include "vulkan/vulkan_core.h"
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_vulkan.h>
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdalign.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include <vulkan/vulkan.h>
 
+#ifdef SHADER_HOT_RELOAD
+#ifndef __linux__
+#error "shader hot reloading uses inotify, which is linux only"
+#endif
+#include <poll.h>
+#include <shaderc/shaderc.h>
+#include <sys/inotify.h>
+#endif
+
 #define DEBUG 1
 
 #define VK_KHR_VALIDATION_LAYER_NAME "VK_LAYER_KHRONOS_validation"
 #define VK_KHR_PORTABILITY_SUBSET_EXT_NAME "VK_KHR_portability_subset"
+// environment variable that picks a device, like --device:
+#define DEVICE_ENV_VAR "VULKAN_DEMO_DEVICE"
 
 #define dbg(cformat, ...)                                                                          \
     fprintf(stderr, "%s:%d ", __FILE__, __LINE__);                                                 \
@@ -41,24 +64,47 @@
         dbg(format, list[i]);                                                                      \
     }
 
-// Required layers for a instance:
-#define REQUIRED_INST_LAYERS_LEN 1
-const char *required_inst_layers[REQUIRED_INST_LAYERS_LEN] = {VK_KHR_VALIDATION_LAYER_NAME};
-
-// Required extensions for an instance (+ whatever SDL loads):
-#define REQUIRED_INST_EXT_LEN 1
-const char *required_inst_extensions[REQUIRED_INST_EXT_LEN] = {
-    VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME};
-
-// Required layers for a logical device
-#define REQUIRED_LOGIC_DEV_LAYERS_LEN 1
-const char *required_logic_dev_layers_names[REQUIRED_LOGIC_DEV_LAYERS_LEN] = {
-    VK_KHR_VALIDATION_LAYER_NAME};
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
 
-// Required extensions for a logical device
-#define REQUIRED_LOGIC_DEV_EXT_LEN 2
-const char *required_logic_dev_ext_names[REQUIRED_LOGIC_DEV_EXT_LEN] = {
-    VK_KHR_PORTABILITY_SUBSET_EXT_NAME, VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+// How many frames the CPU is allowed to record ahead of the GPU.  With 1 the CPU waits for the GPU
+// to finish every frame before it starts the next one; with 2-3 recording frame N+1 overlaps the
+// GPU executing frame N.  Set from the makefile with `make FRAMES_IN_FLIGHT=3`.
+#ifndef MAX_FRAMES_IN_FLIGHT
+#define MAX_FRAMES_IN_FLIGHT 2
+#endif
+static_assert(MAX_FRAMES_IN_FLIGHT >= 1 && MAX_FRAMES_IN_FLIGHT <= 3,
+              "MAX_FRAMES_IN_FLIGHT must be between 1 and 3");
+
+// Layers we turn on (for the instance and the logical device) if they're installed.  Validation
+// comes with the SDK, which headless / CI machines often don't have, so it can't be required:
+#define OPTIONAL_LAYERS_LEN 1
+const char *optional_layers[OPTIONAL_LAYERS_LEN] = {VK_KHR_VALIDATION_LAYER_NAME};
+
+// Extensions for an instance (+ whatever SDL loads).  Portability enumeration is only available
+// (and only needed) on top of MoltenVK, so it's enabled if present rather than required.
+#define MAX_INST_EXT_LEN 1
+
+// Extensions for a logical device: swapchain (unless we're headless) + portability subset and
+// memory budget (if the device advertises them)
+#define MAX_LOGIC_DEV_EXT_LEN 3
+
+// Where the pipeline cache is persisted between runs (relative to the working directory, like the
+// shaders):
+#define PIPELINE_CACHE_PATH "pipeline_cache.bin"
+
+// Size of the window, and of the offscreen images we render to in headless mode:
+#define WINDOW_WIDTH 640
+#define WINDOW_HEIGHT 480
+
+// Called with the tightly packed R8G8B8A8 pixels of every frame rendered in headless mode, once the
+// GPU has finished writing them.  The pixel memory is only valid for the duration of the call.
+typedef void (*vk_readback_fn)(const uint8_t *pixels, uint32_t width, uint32_t height,
+                               uint64_t frame_number, void *user_data);
 
 // Temporary struct used to store graphics & presentation queue indices during device init that
 // we can examine to check whether the device supports the queues we need;
@@ -66,12 +112,15 @@ typedef struct vk_queue_indices
 {
     int32_t graphics;
     int32_t presentation;
+    // a transfer-only family if the device has one, otherwise the same as graphics
+    int32_t transfer;
 } vk_queue_indices;
 
 void vk_queue_indices_init(vk_queue_indices *indices)
 {
     indices->graphics = -1;
     indices->presentation = -1;
+    indices->transfer = -1;
 }
 
 bool vk_queue_indices_is_suitable(vk_queue_indices *indices)
@@ -79,6 +128,434 @@ bool vk_queue_indices_is_suitable(vk_queue_indices *indices)
     return indices->graphics != -1 && indices->presentation != -1;
 }
 
+// Frames rendered (and thrown away) before a --bench run starts measuring, so that pipeline
+// warm-up and the first few swapchain acquires don't skew the results:
+#define BENCH_WARMUP_FRAMES 16
+
+// Phases of draw_frame that we time on the CPU when benchmarking.  PHASE_FRAME is the full frame
+// time (start of one draw_frame call to the start of the next).
+typedef enum frame_phase
+{
+    PHASE_FRAME,
+    PHASE_WAIT,
+    PHASE_ACQUIRE,
+    PHASE_RECORD,
+    PHASE_SUBMIT,
+    PHASE_PRESENT,
+    PHASE_COUNT,
+} frame_phase;
+
+static const char *frame_phase_names[PHASE_COUNT] = {
+    "frame", "wait", "acquire", "record", "submit", "present",
+};
+
+// Passes that get a pair of GPU timestamps written around them every frame (the cull pair is
+// written back to back when there's no --gpu-cull dispatch, so that pass just reads ~0):
+typedef enum gpu_pass
+{
+    GPU_PASS_CULL,
+    GPU_PASS_MAIN,
+    GPU_PASS_COUNT,
+} gpu_pass;
+
+static const char *gpu_pass_names[GPU_PASS_COUNT] = {"cull", "main"};
+
+// How the per-frame primary command buffers get reset before re-recording them: individually with
+// vkResetCommandBuffer (which needs a pool with RESET_COMMAND_BUFFER_BIT), or by resetting a
+// transient pool per frame slot with vkResetCommandPool, which tends to be cheaper.
+typedef enum cmd_reset_mode
+{
+    CMD_RESET_BUFFER,
+    CMD_RESET_POOL,
+    CMD_RESET_MODE_COUNT,
+} cmd_reset_mode;
+
+static const char *cmd_reset_mode_names[CMD_RESET_MODE_COUNT] = {"buffer", "pool"};
+
+typedef struct bench_series
+{
+    uint32_t count;
+    uint32_t cap;
+    double *samples_ms;
+} bench_series;
+
+typedef struct bench_stats
+{
+    bench_series cpu[PHASE_COUNT];
+    bench_series gpu[GPU_PASS_COUNT];
+    // CLOCK_MONOTONIC time the previous draw_frame started at, 0 before the first frame
+    uint64_t last_frame_start_ns;
+} bench_stats;
+
+// GPU memory allocator.  Rather than calling vkAllocateMemory for every buffer and image (which is
+// slow, and limited to maxMemoryAllocationCount allocations which can be as low as 4096), we
+// allocate big blocks of device memory and hand out pieces of them with a buddy allocator:
+// every block is split into power-of-two sized buddies, and freeing a buddy merges it back with its
+// neighbour if that one is free too.
+
+// Size of the device memory blocks we sub-allocate from.  Anything bigger than this gets its own
+// dedicated vkAllocateMemory call.
+#define ALLOC_BLOCK_SIZE (64ull * 1024 * 1024)
+// Smallest buddy we hand out (log2), i.e. 256 bytes; smaller requests get rounded up to this.
+#define ALLOC_MIN_SIZE_LOG2 8
+// Number of buddy sizes between ALLOC_MIN_SIZE and ALLOC_BLOCK_SIZE (256B, 512B, ... 64MiB):
+#define ALLOC_ORDERS 19
+#define ALLOC_MAX_BLOCKS 128
+
+// Bytes of per-frame scratch memory (see vk_frame_alloc) for each frame in flight:
+#define FRAME_ARENA_SIZE (4ull * 1024 * 1024)
+
+typedef struct vk_memory_block
+{
+    VkDeviceMemory memory;
+    uint32_t memory_type;
+    // buffers and optimally tiled images are kept in separate blocks so that we never have to
+    // worry about bufferImageGranularity between neighbouring allocations
+    bool linear;
+    // the whole block stays mapped if the memory type is host visible, NULL otherwise
+    void *mapped;
+    VkDeviceSize used;
+    VkDeviceSize requested;
+    // per order (0 = smallest buddy), a list of the offsets of the free buddies of that size
+    uint32_t free_counts[ALLOC_ORDERS];
+    uint32_t free_caps[ALLOC_ORDERS];
+    VkDeviceSize *free_lists[ALLOC_ORDERS];
+} vk_memory_block;
+
+typedef struct vk_allocation
+{
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    // pointer to the start of the allocation if the memory is host visible, NULL otherwise
+    void *mapped;
+    // index into vk_allocator.blocks, or -1 for a dedicated allocation
+    int32_t block;
+    uint32_t order;
+} vk_allocation;
+
+typedef struct vk_allocator
+{
+    VkPhysicalDeviceMemoryProperties memory_props;
+    uint32_t block_count;
+    vk_memory_block blocks[ALLOC_MAX_BLOCKS];
+    uint32_t dedicated_count;
+    VkDeviceSize dedicated_bytes;
+} vk_allocator;
+
+typedef struct vk_allocator_stats
+{
+    uint32_t block_count;
+    uint32_t dedicated_count;
+    // device memory we've allocated from the driver, in total
+    VkDeviceSize bytes_allocated;
+    // bytes handed out (rounded up to the buddy size), and what was actually asked for
+    VkDeviceSize bytes_used;
+    VkDeviceSize bytes_requested;
+    VkDeviceSize largest_free;
+    // 0 when all free memory is in one piece, approaching 1 the more it's broken up
+    double fragmentation;
+} vk_allocator_stats;
+
+// A persistently mapped buffer that is carved into one region per frame in flight.  Each frame
+// bump-allocates transient data (anything that's rewritten every frame) out of its region, and the
+// whole region is reset once the frame's fence says the GPU is done with it.
+typedef struct vk_frame_arena
+{
+    VkBuffer buffer;
+    vk_allocation allocation;
+    uint32_t frame;
+    VkDeviceSize head;
+    // most bytes any one frame has used, for sizing FRAME_ARENA_SIZE
+    VkDeviceSize high_water;
+} vk_frame_arena;
+
+typedef struct vk_transient_alloc
+{
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    void *data;
+} vk_transient_alloc;
+
+// Size of the host visible ring buffer that uploads to device local memory are staged through, and
+// how many upload batches (command buffer + fence) can be in flight at once:
+#define STAGING_RING_SIZE (16ull * 1024 * 1024)
+#define UPLOAD_BATCHES 4
+
+// Pipeline stages that read uploaded data, i.e. what the graphics queue waits on / acquires at:
+#define UPLOAD_CONSUMER_STAGES                                                                     \
+    (VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |                    \
+     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+
+typedef struct vk_upload_batch
+{
+    VkCommandBuffer command_buffer;
+    // timeline semaphore value the batch signals when it's done
+    uint64_t value;
+    // ring position of the end of the batch's staging data; once the batch is done everything
+    // before it can be reused
+    VkDeviceSize ring_end;
+    bool pending;
+} vk_upload_batch;
+
+typedef struct vk_uploader
+{
+    uint32_t queue_family;
+    VkQueue queue;
+    VkCommandPool command_pool;
+    VkSemaphore timeline;
+    uint64_t timeline_value;
+    VkBuffer staging_buffer;
+    vk_allocation staging_allocation;
+    // head and tail only ever grow, positions in the buffer are taken modulo STAGING_RING_SIZE
+    VkDeviceSize head;
+    VkDeviceSize tail;
+    vk_upload_batch batches[UPLOAD_BATCHES];
+    // the batch that new copies get recorded into, and whether we've begun recording it
+    uint32_t current;
+    bool recording;
+
+    // Queue family ownership transfers, only used when uploads run on a different family from
+    // graphics.  Releases get recorded at the end of the current batch, acquires at the start of
+    // the next frame, which waits on the timeline for `acquire_value`.
+    VkBufferMemoryBarrier *releases;
+    uint32_t releases_count;
+    VkBufferMemoryBarrier *acquires;
+    uint32_t acquires_count;
+    uint32_t ownership_capacity;
+    uint64_t acquire_value;
+} vk_uploader;
+
+// A swapchain that was replaced by vk_recreate_swap_chain, along with everything pointing at its
+// images, waiting for the frames that used it to finish before it gets destroyed:
+typedef struct vk_retired_swapchain
+{
+    VkSwapchainKHR swapchain;
+    VkImage *images;
+    VkImageView *image_views;
+    VkFramebuffer *framebuffers;
+    VkImage *depth_images;
+    VkImageView *depth_views;
+    vk_allocation *depth_allocations;
+    VkImage *msaa_images;
+    VkImageView *msaa_views;
+    vk_allocation *msaa_allocations;
+    VkSemaphore *sem_render_finished;
+    uint32_t image_count;
+    // context->frame_number at the time it was replaced
+    uint64_t retired_at;
+} vk_retired_swapchain;
+
+#define MAX_RETIRED_SWAPCHAINS (MAX_FRAMES_IN_FLIGHT + 1)
+
+// Upper limit for --record-threads, so the per-thread arrays can live in fixed size structs:
+#define MAX_WORKER_THREADS 16
+
+typedef void (*job_fn)(void *user_data, uint32_t job_index);
+
+// A fixed set of worker threads that run one batch of jobs at a time: job_pool_start hands out
+// `job_count` calls to `fn` (one per job index) and job_pool_wait blocks until they're all done.
+typedef struct job_pool
+{
+    pthread_t threads[MAX_WORKER_THREADS];
+    uint32_t thread_count;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    // bumped every time a batch is started, so workers can tell a new batch from a spurious wakeup
+    uint64_t generation;
+    job_fn fn;
+    void *user_data;
+    uint32_t job_count;
+    uint32_t next_job;
+    uint32_t jobs_remaining;
+    bool shutdown;
+} job_pool;
+
+// One contiguous range of the draw list.  Each record slice gets its own command pool (per frame in
+// flight) since pools can only be used from one thread at a time:
+typedef struct vk_record_slice
+{
+    VkCommandPool pools[MAX_FRAMES_IN_FLIGHT];
+    VkCommandBuffer buffers[MAX_FRAMES_IN_FLIGHT];
+} vk_record_slice;
+
+// Per-object data that the vertex shader (indexed by gl_InstanceIndex) and the culling shader read
+// out of a storage buffer.  Has to match `Object` in shaders/shader.vert and shaders/cull.comp
+// (std430 layout).
+typedef struct gpu_object
+{
+    float center[2];
+    float scale;
+    // bounding circle radius, already scaled
+    float radius;
+    uint32_t index_count;
+    uint32_t first_index;
+    int32_t vertex_offset;
+    // which of the streamed textures it uses (an index into frame_uniforms::texture_slots, not a
+    // bindless slot, since those change as the texture's mips come and go), or NO_TEXTURE
+    uint32_t texture;
+} gpu_object;
+
+static_assert(sizeof(gpu_object) == 32, "gpu_object must match the std430 layout in the shaders");
+
+// The bindless descriptor set (see vk_init_bindless), which is set 0 of the graphics pipelines.
+// Must match the declarations in the shaders:
+#define BINDLESS_BUFFER_BINDING 0
+#define BINDLESS_IMAGE_BINDING 1
+// (at most; vk_init_bindless clamps these to the device's update-after-bind limits)
+#define MAX_BINDLESS_BUFFERS 1024
+#define MAX_BINDLESS_IMAGES 4096
+// gpu_object::texture / bindless slot for "none":
+#define NO_TEXTURE UINT32_MAX
+// Most textures that can be streamed at once (see vk_init_textures):
+#define MAX_TEXTURES 64
+
+// Push constants for the graphics pipelines: which bindless slots the draws read from
+typedef struct draw_push_constants
+{
+    // index of the gpu_object buffer in the bindless buffer array
+    uint32_t object_buffer;
+} draw_push_constants;
+
+// Per-frame uniforms, set 1 of the graphics pipelines (std140, must match the Frame block in the
+// vertex shaders).  Written into the frame arena every frame, see vk_init_frame_uniforms.
+typedef struct frame_uniforms
+{
+    // the 2D camera: the world position at the center of the screen, and how much to magnify
+    float camera_center[2];
+    float camera_zoom;
+    // seconds, based on frame_number so that headless runs are reproducible
+    float time;
+    // bindless image slot of every streamed texture's current image (or NO_TEXTURE).  std140
+    // pads uint arrays out to 16 bytes per element, so the shaders see this as uvec4s.
+    uint32_t texture_slots[MAX_TEXTURES];
+} frame_uniforms;
+
+// Push constants for shaders/cull.comp, which processes CULL_WORKGROUP_SIZE objects per workgroup:
+#define CULL_WORKGROUP_SIZE 64
+
+typedef struct cull_push_constants
+{
+    float bounds_min[2];
+    float bounds_max[2];
+    uint32_t object_count;
+    // 1 = append visible draws and count them (for vkCmdDrawIndexedIndirectCount), 0 = write a
+    // draw for every object, with instanceCount = 0 for the culled ones
+    uint32_t compact;
+} cull_push_constants;
+
+// Push constants for shaders/mipgen.comp, which writes one 8x8 tile of a mip level per workgroup:
+#define MIP_WORKGROUP_SIZE 8
+
+typedef struct mip_push_constants
+{
+    int32_t src_size[2];
+    int32_t dst_size[2];
+} mip_push_constants;
+
+// Block compressed formats for textures, best first.  Assets can come in a variant per format
+// (foo.bc7.ktx2 next to foo.ktx2, see vk_init_textures), and we load the one for the first format
+// on the list that the device can sample.
+typedef struct texture_compression
+{
+    const char *suffix;
+    VkFormat format;
+} texture_compression;
+
+static const texture_compression texture_compressions[] = {
+    {"bc7", VK_FORMAT_BC7_SRGB_BLOCK},
+    {"astc", VK_FORMAT_ASTC_4x4_SRGB_BLOCK},
+    {"etc2", VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK},
+};
+#define TEXTURE_COMPRESSIONS_LEN (sizeof(texture_compressions) / sizeof(texture_compression))
+
+// Per-instance vertex data for --instances, matching the instance-rate inputs of
+// shaders/instanced.vert:
+typedef struct instance_data
+{
+    // offset x, offset y, scale, rotation (radians)
+    float transform[4];
+    // RGBA8 unorm, multiplied with the vertex color
+    uint8_t color[4];
+} instance_data;
+
+// A single indexed draw out of the shared vertex / index buffers:
+typedef struct vk_draw
+{
+    uint32_t index_count;
+    uint32_t first_index;
+    int32_t vertex_offset;
+} vk_draw;
+
+// Feature bits that pick a permutation of the graphics pipelines.  Each one is a specialization
+// constant in the shaders (see shader_specialization), so the driver folds the branches on it away
+// when it compiles the pipeline, instead of every fragment paying for them at runtime.
+typedef enum pipeline_feature
+{
+    // color everything by object / instance index instead of its vertex colors (toggle with O)
+    PIPELINE_FEATURE_DEBUG_OBJECTS = 1 << 0,
+    // the swapchain isn't an _SRGB format, so the fragment shader has to encode its output itself
+    PIPELINE_FEATURE_ENCODE_SRGB = 1 << 1,
+} pipeline_feature;
+
+#define PIPELINE_FEATURE_COUNT 2
+#define PIPELINE_VARIANT_COUNT (1 << PIPELINE_FEATURE_COUNT)
+
+// Specialization constant values for one permutation.  Must match the constant_ids in shaders/ (a
+// stage just ignores the constants it doesn't declare, so every stage gets all of them):
+typedef struct shader_specialization
+{
+    VkBool32 debug_objects; // constant_id = 0
+    VkBool32 encode_srgb;   // constant_id = 1
+} shader_specialization;
+
+// One permutation of the graphics pipelines (the instanced ones only exist with --instances, and
+// the prepass ones with --depth-prepass):
+typedef struct vk_pipeline_variant
+{
+    VkPipeline pipeline;
+    VkPipeline instanced_pipeline;
+    VkPipeline prepass_pipeline;
+    VkPipeline instanced_prepass_pipeline;
+} vk_pipeline_variant;
+
+#ifdef SHADER_HOT_RELOAD
+// Shader hot reloading (see vk_init_shader_hot_reload):
+#define MAX_RETIRED_PIPELINE_SETS (MAX_FRAMES_IN_FLIGHT + 1)
+
+// Every pipeline that gets rebuilt when a shader changes:
+typedef struct vk_pipeline_set
+{
+    vk_pipeline_variant variants[PIPELINE_VARIANT_COUNT];
+    VkPipeline cull_pipeline;
+    // context->frame_number when it was swapped out
+    uint64_t retired_at;
+} vk_pipeline_set;
+
+typedef struct shader_hot_reload
+{
+    pthread_t thread;
+    int inotify_fd;
+    shaderc_compiler_t compiler;
+    // guards stop / pending / pending_set, which the watcher thread writes
+    pthread_mutex_t mutex;
+    bool stop;
+    bool pending;
+    vk_pipeline_set pending_set;
+    // only used by the main thread
+    uint32_t retired_count;
+    vk_pipeline_set retired[MAX_RETIRED_PIPELINE_SETS];
+} shader_hot_reload;
+#endif
+
+// Interleaved vertex format, matching the inputs of shaders/shader.vert:
+typedef struct vertex
+{
+    float pos[2];
+    float color[3];
+} vertex;
+
 typedef struct vk_swapchain_support
 {
     VkSurfaceCapabilitiesKHR *surface_capabilities;
@@ -91,13 +568,24 @@ typedef struct vk_swapchain_support
 
 typedef struct vk_context
 {
+    // NULL in headless mode, in which case there is also no surface, swapchain or presentation and
+    // we render to offscreen images instead
     SDL_Window *window;
+    bool headless;
     VkInstance instance;
+    // the optional_layers that are installed, enabled on the instance and the logical device
+    const char *layers[OPTIONAL_LAYERS_LEN];
+    uint32_t layer_count;
     VkPhysicalDevice physical_device;
+    VkPhysicalDeviceProperties physical_device_props;
     VkDevice logical_device;
+    vk_allocator allocator;
+    vk_frame_arena frame_arena;
+    vk_uploader uploader;
     VkSurfaceKHR surface;
     VkQueue graphics_queue;
     VkQueue presentation_queue;
+    VkQueue transfer_queue;
     // used as scratch space during the is_device_suitable_loop
     vk_queue_indices queue_indices;
 
@@ -113,21 +601,172 @@ typedef struct vk_context
     uint32_t image_views_count;
     VkImageView *image_views;
 
+    // one depth buffer per swapchain image, reverse-Z (see vk_create_graphics_pipeline)
+    VkFormat depth_format;
+    VkImage *depth_images;
+    VkImageView *depth_views;
+    vk_allocation *depth_allocations;
+    // --depth-prepass: draw everything depth-only first, then shade just the visible fragments
+    bool depth_prepass;
+    // --msaa: samples per pixel.  Above 1, we render to one multisampled color image per swapchain
+    // image and resolve into the swapchain image (otherwise msaa_* are NULL)
+    VkSampleCountFlagBits msaa_samples;
+    VkImage *msaa_images;
+    VkImageView *msaa_views;
+    vk_allocation *msaa_allocations;
+
+    // set when the swapchain no longer matches the window, and re-created at the start of the next
+    // frame
+    bool swapchain_dirty;
+    uint32_t retired_swapchain_count;
+    vk_retired_swapchain retired_swapchains[MAX_RETIRED_SWAPCHAINS];
+
+    // geometry
+    VkBuffer vertex_buffer;
+    vk_allocation vertex_allocation;
+    VkBuffer index_buffer;
+    vk_allocation index_allocation;
+    uint32_t index_count;
+    vk_draw *draws;
+    uint32_t draw_count;
+
+    // scene objects (one per draw), read by the vertex shader through the bindless set, and the
+    // CPU's copy for working out which textures are visible
+    gpu_object *objects;
+    VkBuffer object_buffer;
+    vk_allocation object_allocation;
+    uint32_t object_buffer_index;
+    // for the (non-bindless) culling sets
+    VkDescriptorPool descriptor_pool;
+
+    // the bindless descriptor set, and how many of its buffer / image slots are taken
+    VkDescriptorSetLayout bindless_layout;
+    VkDescriptorPool bindless_pool;
+    VkDescriptorSet bindless_set;
+    uint32_t bindless_buffer_count;
+    uint32_t bindless_image_count;
+    // array sizes of the set: MAX_BINDLESS_BUFFERS / MAX_BINDLESS_IMAGES, or less if the device
+    // can't do that many
+    uint32_t bindless_buffer_capacity;
+    uint32_t bindless_image_capacity;
+    // image slots given back with vk_bindless_release_image, reused before new ones
+    uint32_t *bindless_free_images;
+    uint32_t bindless_free_image_count;
+
+    // streamed textures (NULL without --texture), and whether VK_EXT_memory_budget is enabled
+    struct vk_texture_streamer *textures;
+    bool memory_budget;
+    // the texture_compressions entry for the device (NULL if it has none of them), and whether
+    // shaders/mipgen.comp can write to storage images without declaring their format
+    const texture_compression *texture_compression;
+    bool storage_write_without_format;
+
+    // per-frame uniforms (set 1): one dynamic uniform buffer descriptor over the frame arena, and
+    // the offset of this frame's frame_uniforms in it
+    VkDescriptorSetLayout uniform_set_layout;
+    VkDescriptorSet uniform_set;
+    uint32_t uniform_offset;
+    float camera_center[2];
+    float camera_zoom;
+
+    // instanced drawing (--instances): instance_count copies of the mesh in one draw, with the
+    // per-instance stream in instance_buffer (one slot per frame in flight, persistently mapped)
+    uint32_t instance_count;
+    VkBuffer instance_buffer;
+    vk_allocation instance_allocation;
+    VkPipeline instanced_pipeline;
+
+    // GPU driven culling (--gpu-cull): draws come out of indirect_buffers (and, with
+    // draw_indirect_count, draw_count_buffers) written by cull_pipeline
+    bool gpu_cull;
+    bool multi_draw_indirect;
+    bool draw_indirect_count;
+    VkDescriptorSetLayout cull_set_layout;
+    VkPipelineLayout cull_pipeline_layout;
+    VkPipeline cull_pipeline;
+    VkBuffer indirect_buffers[MAX_FRAMES_IN_FLIGHT];
+    vk_allocation indirect_allocations[MAX_FRAMES_IN_FLIGHT];
+    VkBuffer draw_count_buffers[MAX_FRAMES_IN_FLIGHT];
+    vk_allocation draw_count_allocations[MAX_FRAMES_IN_FLIGHT];
+    VkDescriptorSet cull_sets[MAX_FRAMES_IN_FLIGHT];
+
     // pipeline
+    VkPipelineCache pipeline_cache;
+    // NULL when loading loose shader files
+    struct shader_archive *shaders;
+    VkPipelineLayout pipeline_layout;
+    // every permutation built so far, indexed by pipeline_feature bits.  pipeline (and
+    // instanced_pipeline) are the ones for pipeline_features, which is what we draw with
+    vk_pipeline_variant pipeline_variants[PIPELINE_VARIANT_COUNT];
+    uint32_t pipeline_features;
     VkPipeline pipeline;
+    VkPipeline prepass_pipeline;
+    VkPipeline instanced_prepass_pipeline;
+    // the startup pipeline builds, until they're all done (see vk_start_pipeline_builds)
+    struct vk_pipeline_builder *pipeline_builder;
+#ifdef SHADER_HOT_RELOAD
+    shader_hot_reload *hot_reload;
+#endif
+    // Render with vkCmdBeginRendering + synchronization2 barriers instead of render_pass /
+    // framebuffers.  main sets this to what the user asked for, and vk_init_logical_device turns it
+    // off if the device can't do it.
+    bool dynamic_rendering;
     VkRenderPass render_pass;
 
     // framebuffers
     uint32_t framebuffer_count;
     VkFramebuffer *framebuffers;
 
+    // CMD_RESET_BUFFER: one pool, buffers reset individually
     VkCommandPool command_pool;
-    VkCommandBuffer command_buffer;
-
-    // sync:
-    VkSemaphore sem_image_available;
-    VkSemaphore sem_render_finished;
-    VkFence fence_in_flight;
+    VkCommandBuffer command_buffers[MAX_FRAMES_IN_FLIGHT];
+    // CMD_RESET_POOL: a transient pool (with one buffer) per frame slot, reset as a whole
+    cmd_reset_mode cmd_reset;
+    VkCommandPool frame_command_pools[MAX_FRAMES_IN_FLIGHT];
+    VkCommandBuffer frame_command_buffers[MAX_FRAMES_IN_FLIGHT];
+
+    // multithreaded recording (--record-threads), NULL / 0 = record everything on the main thread
+    job_pool *jobs;
+    uint32_t record_slice_count;
+    vk_record_slice *record_slices;
+    // the image the recording threads are drawing into this frame
+    uint32_t record_image_index;
+
+    // sync (one set per frame in flight, indexed by current_frame):
+    uint32_t current_frame;
+    VkSemaphore sem_image_available[MAX_FRAMES_IN_FLIGHT];
+    VkFence fences_in_flight[MAX_FRAMES_IN_FLIGHT];
+    // ...except for this one, which is indexed by swapchain image (NULL in headless mode): the
+    // present that waits on it only happens-before the next acquire of the same image, so that's
+    // the only point at which we know it's been waited on and can be signaled again
+    VkSemaphore *sem_render_finished;
+    // indexed by swapchain image: the fence of the frame that last rendered to that image, so that
+    // we don't start rendering to an image the GPU is still working on when the swapchain hands
+    // images back to us out of order
+    VkFence *images_in_flight;
+    // incremented for every frame submitted to the GPU
+    uint64_t frame_number;
+
+    // headless only: the device memory behind the offscreen images in swapchain_images, plus one
+    // host visible buffer per image that the rendered frame is copied into for readback
+    vk_allocation *offscreen_allocations;
+    VkBuffer *readback_buffers;
+    vk_allocation *readback_allocations;
+    // the frame number that is waiting to be read back from each image, or UINT64_MAX if none
+    uint64_t *readback_pending;
+    vk_readback_fn readback_callback;
+    void *readback_user_data;
+
+    // benchmarking: NULL / VK_NULL_HANDLE unless running with --bench
+    bench_stats *bench;
+    VkQueryPool timestamp_pool;
+    // nanoseconds per timestamp tick
+    float timestamp_period;
+    // the bits of a timestamp that are actually counting (the rest are garbage), so that
+    // subtracting masked values works across a wraparound
+    uint64_t timestamp_mask;
+    // whether the frame slot has timestamps written that we haven't read back yet
+    bool timestamps_pending[MAX_FRAMES_IN_FLIGHT];
 } vk_context;
 
 // Allocates and initializes a new vk_context on the heap
@@ -135,39 +774,165 @@ vk_context *vk_context_alloc(SDL_Window *window)
 {
     vk_context *ctx = (vk_context *)malloc(sizeof(vk_context));
     ctx->window = window;
+    ctx->headless = window == NULL;
     ctx->instance = VK_NULL_HANDLE;
+    ctx->layer_count = 0;
     ctx->swapchain_support = NULL;
 
     ctx->physical_device = VK_NULL_HANDLE;
     ctx->logical_device = VK_NULL_HANDLE;
+    memset(&ctx->allocator, 0, sizeof(vk_allocator));
+    memset(&ctx->frame_arena, 0, sizeof(vk_frame_arena));
+    memset(&ctx->uploader, 0, sizeof(vk_uploader));
+    ctx->vertex_buffer = VK_NULL_HANDLE;
+    ctx->index_buffer = VK_NULL_HANDLE;
+    ctx->index_count = 0;
+    ctx->draws = NULL;
+    ctx->draw_count = 0;
+    ctx->object_buffer = VK_NULL_HANDLE;
+    ctx->object_buffer_index = 0;
+    ctx->objects = NULL;
+    ctx->descriptor_pool = VK_NULL_HANDLE;
+    ctx->bindless_layout = VK_NULL_HANDLE;
+    ctx->bindless_pool = VK_NULL_HANDLE;
+    ctx->bindless_set = VK_NULL_HANDLE;
+    ctx->bindless_buffer_count = 0;
+    ctx->bindless_image_count = 0;
+    ctx->bindless_buffer_capacity = 0;
+    ctx->bindless_image_capacity = 0;
+    ctx->bindless_free_images = NULL;
+    ctx->bindless_free_image_count = 0;
+    ctx->textures = NULL;
+    ctx->memory_budget = false;
+    ctx->texture_compression = NULL;
+    ctx->storage_write_without_format = false;
+    ctx->uniform_set_layout = VK_NULL_HANDLE;
+    ctx->uniform_set = VK_NULL_HANDLE;
+    ctx->uniform_offset = 0;
+    ctx->camera_center[0] = 0.0f;
+    ctx->camera_center[1] = 0.0f;
+    ctx->camera_zoom = 1.0f;
+    ctx->instance_count = 0;
+    ctx->instance_buffer = VK_NULL_HANDLE;
+    ctx->instanced_pipeline = VK_NULL_HANDLE;
+    ctx->prepass_pipeline = VK_NULL_HANDLE;
+    ctx->instanced_prepass_pipeline = VK_NULL_HANDLE;
+    ctx->gpu_cull = false;
+    ctx->multi_draw_indirect = false;
+    ctx->draw_indirect_count = false;
+    ctx->cull_set_layout = VK_NULL_HANDLE;
+    ctx->cull_pipeline_layout = VK_NULL_HANDLE;
+    ctx->cull_pipeline = VK_NULL_HANDLE;
+#ifdef SHADER_HOT_RELOAD
+    ctx->hot_reload = NULL;
+#endif
 
     ctx->graphics_queue = VK_NULL_HANDLE;
     ctx->presentation_queue = VK_NULL_HANDLE;
+    ctx->transfer_queue = VK_NULL_HANDLE;
 
     ctx->surface = VK_NULL_HANDLE;
     vk_queue_indices_init(&ctx->queue_indices);
 
+    ctx->swapchain = VK_NULL_HANDLE;
     ctx->swapchain_image_count = 0;
     ctx->image_views_count = 0;
     ctx->swapchain_image_count = 0;
+    ctx->swapchain_dirty = false;
+    ctx->retired_swapchain_count = 0;
 
     ctx->render_pass = VK_NULL_HANDLE;
+    ctx->dynamic_rendering = true;
+    ctx->depth_format = VK_FORMAT_UNDEFINED;
+    ctx->depth_images = NULL;
+    ctx->depth_views = NULL;
+    ctx->depth_allocations = NULL;
+    ctx->depth_prepass = false;
+    ctx->msaa_samples = VK_SAMPLE_COUNT_1_BIT;
+    ctx->msaa_images = NULL;
+    ctx->msaa_views = NULL;
+    ctx->msaa_allocations = NULL;
+    ctx->framebuffer_count = 0;
+    ctx->framebuffers = NULL;
+    ctx->pipeline_cache = VK_NULL_HANDLE;
+    ctx->shaders = NULL;
+    for (uint32_t i = 0; i < PIPELINE_VARIANT_COUNT; i++)
+    {
+        ctx->pipeline_variants[i] = (vk_pipeline_variant){
+            VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
+    }
+    ctx->pipeline_features = 0;
+    ctx->pipeline_builder = NULL;
     ctx->command_pool = VK_NULL_HANDLE;
-    ctx->command_buffer = VK_NULL_HANDLE;
+    ctx->cmd_reset = CMD_RESET_POOL;
+    ctx->jobs = NULL;
+    ctx->record_slice_count = 0;
+    ctx->record_slices = NULL;
+    ctx->record_image_index = 0;
+    ctx->current_frame = 0;
+    ctx->frame_number = 0;
+    ctx->images_in_flight = NULL;
+
+    ctx->offscreen_allocations = NULL;
+    ctx->readback_buffers = NULL;
+    ctx->readback_allocations = NULL;
+    ctx->readback_pending = NULL;
+    ctx->readback_callback = NULL;
+    ctx->readback_user_data = NULL;
+
+    ctx->bench = NULL;
+    ctx->timestamp_pool = VK_NULL_HANDLE;
+    ctx->timestamp_period = 0.0f;
+    ctx->timestamp_mask = 0;
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        ctx->command_buffers[i] = VK_NULL_HANDLE;
+        ctx->frame_command_pools[i] = VK_NULL_HANDLE;
+        ctx->frame_command_buffers[i] = VK_NULL_HANDLE;
+        ctx->sem_image_available[i] = VK_NULL_HANDLE;
+        ctx->fences_in_flight[i] = VK_NULL_HANDLE;
+        ctx->timestamps_pending[i] = false;
+    }
+    ctx->sem_render_finished = NULL;
     return ctx;
 }
 
-// Initializes the `VkInstance` on the provided `vk_context`.
+static bool instance_extension_available(const char *name)
+{
+    uint32_t extension_count;
+    vk_checked(vkEnumerateInstanceExtensionProperties(NULL, &extension_count, NULL));
+    VkExtensionProperties extension_props[extension_count];
+    vk_checked(vkEnumerateInstanceExtensionProperties(NULL, &extension_count, extension_props));
+
+    for (uint32_t i = 0; i < extension_count; i++)
+    {
+        if (strcmp(name, extension_props[i].extensionName) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Initializes the `VkInstance` on the provided `vk_context`.  `window` may be NULL in headless
+// mode, in which case we don't need any of the surface extensions SDL asks for.
 void vk_init_instance(vk_context *context, const char *app_name, SDL_Window *window)
 {
     assert(context && "must call vk_context_alloc before vk_init_instance");
     // Get SDL extensions:
-    uint32_t sdl_extension_count;
-    sdl_checked(SDL_Vulkan_GetInstanceExtensions(window, &sdl_extension_count, NULL));
+    uint32_t sdl_extension_count = 0;
+    if (window != NULL)
+    {
+        sdl_checked(SDL_Vulkan_GetInstanceExtensions(window, &sdl_extension_count, NULL));
+    }
 
-    const char *sdl_extension_names[sdl_extension_count];
-    sdl_checked(
-        SDL_Vulkan_GetInstanceExtensions(window, &sdl_extension_count, sdl_extension_names));
+    const char *sdl_extension_names[sdl_extension_count + 1];
+    if (window != NULL)
+    {
+        sdl_checked(
+            SDL_Vulkan_GetInstanceExtensions(window, &sdl_extension_count, sdl_extension_names));
+    }
 
     VkApplicationInfo app_info = {
         .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -178,15 +943,16 @@ void vk_init_instance(vk_context *context, const char *app_name, SDL_Window *win
         .apiVersion = VK_API_VERSION_1_3,
     };
 
-    // extend extension_names with our required extensions:
-    uint32_t extensions_count = sdl_extension_count + REQUIRED_INST_EXT_LEN;
-    const char *extension_names[extensions_count];
+    // extend extension_names with our own extensions:
+    uint32_t extensions_count = sdl_extension_count;
+    const char *extension_names[sdl_extension_count + MAX_INST_EXT_LEN];
     // copy the string pointers from sdl_extension_names into the complete array:
     memcpy(extension_names, sdl_extension_names, sdl_extension_count * sizeof(char *));
-    // set the elements past sdl_extension_count to our remaining required extensions:
-    for (uint32_t i = sdl_extension_count; i < extensions_count; i++)
+
+    bool portability = instance_extension_available(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
+    if (portability)
     {
-        extension_names[i] = required_inst_extensions[i - sdl_extension_count];
+        extension_names[extensions_count++] = VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME;
     }
     // print out the full list of extensions:
     dbg_str_array(extension_names, extensions_count, "enabling instance extension: %s\n");
@@ -197,39 +963,42 @@ void vk_init_instance(vk_context *context, const char *app_name, SDL_Window *win
     VkLayerProperties layer_props[layer_count];
     vk_checked(vkEnumerateInstanceLayerProperties(&layer_count, layer_props));
 
-    // iterate over them to ensure that the required layers are available:
-    for (uint32_t i = 0; i < REQUIRED_INST_LAYERS_LEN; i++)
+    // iterate over them to find which of the layers we'd like are available:
+    for (uint32_t i = 0; i < OPTIONAL_LAYERS_LEN; i++)
     {
-        const char *required_layer = required_inst_layers[i];
+        const char *optional_layer = optional_layers[i];
         bool found = false;
 
         // this is one time init code, suck my dick big-o
         for (uint32_t j = 0; j < layer_count; j++)
         {
             VkLayerProperties props = layer_props[j];
-            if (strcmp(required_layer, props.layerName) == 0)
+            if (strcmp(optional_layer, props.layerName) == 0)
             {
                 found = true;
             }
         }
 
-        if (!found)
+        if (found)
         {
-            dbg("fatal: could not find required instance layer: %s\n", required_layer);
-            exit(1);
+            context->layers[context->layer_count++] = optional_layer;
+        }
+        else
+        {
+            dbg("layer %s is not installed, running without it\n", optional_layer);
         }
     }
-    dbg_str_array(required_inst_layers, REQUIRED_INST_LAYERS_LEN, "enabling layer: %s\n");
+    dbg_str_array(context->layers, context->layer_count, "enabling layer: %s\n");
 
-    // we now know that we have all required layers & extensions, so we can safely create the
-    // instance:
+    // we now know that we have all required extensions (and which layers we get), so we can
+    // safely create the instance:
     VkInstanceCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
         .pApplicationInfo = &app_info,
-        // required for macOS, should probably configure this based on build
-        .flags = VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR,
-        .enabledLayerCount = REQUIRED_INST_LAYERS_LEN,
-        .ppEnabledLayerNames = required_inst_layers,
+        // required for macOS, and not allowed without the extension everywhere else
+        .flags = portability ? VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR : 0,
+        .enabledLayerCount = context->layer_count,
+        .ppEnabledLayerNames = context->layers,
         .enabledExtensionCount = extensions_count,
         .ppEnabledExtensionNames = extension_names,
     };
@@ -261,6 +1030,9 @@ void vk_init_device_queue_indices(vk_context *context, VkPhysicalDevice device)
     VkQueueFamilyProperties queue_fams[queue_count];
     vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_count, queue_fams);
 
+    // how good a family is as a dedicated upload queue: transfer-only families (the DMA engines on
+    // discrete GPUs) beat async compute families, which beat nothing
+    int32_t best_transfer_score = 0;
     for (uint32_t i = 0; i < queue_count; i++)
     {
         VkQueueFamilyProperties props = queue_fams[i];
@@ -268,6 +1040,23 @@ void vk_init_device_queue_indices(vk_context *context, VkPhysicalDevice device)
         {
             context->queue_indices.graphics = i;
         }
+        else if (props.queueFlags & VK_QUEUE_TRANSFER_BIT)
+        {
+            int32_t score = props.queueFlags & VK_QUEUE_COMPUTE_BIT ? 1 : 2;
+            if (score > best_transfer_score)
+            {
+                context->queue_indices.transfer = i;
+                best_transfer_score = score;
+            }
+        }
+
+        // without a surface there's nothing to present to, so just point presentation at the
+        // graphics queue to keep the logical device / queue handle code the same for both modes
+        if (context->headless)
+        {
+            context->queue_indices.presentation = context->queue_indices.graphics;
+            continue;
+        }
 
         VkBool32 present;
         vkGetPhysicalDeviceSurfaceSupportKHR(device, i, context->surface, &present);
@@ -276,6 +1065,39 @@ void vk_init_device_queue_indices(vk_context *context, VkPhysicalDevice device)
             context->queue_indices.presentation = i;
         }
     }
+
+    // graphics queues can always do transfers too, so fall back to that:
+    if (context->queue_indices.transfer == -1)
+    {
+        context->queue_indices.transfer = context->queue_indices.graphics;
+    }
+}
+
+static bool device_extension_available(VkPhysicalDevice device, const char *name)
+{
+    uint32_t device_extension_count;
+    vk_checked(vkEnumerateDeviceExtensionProperties(device, NULL, &device_extension_count, NULL));
+    VkExtensionProperties device_extension_props[device_extension_count];
+    vk_checked(vkEnumerateDeviceExtensionProperties(device, NULL, &device_extension_count,
+                                                    device_extension_props));
+
+    for (uint32_t i = 0; i < device_extension_count; i++)
+    {
+        if (strcmp(name, device_extension_props[i].extensionName) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void free_swap_chain_support_details(vk_swapchain_support *support)
+{
+    free(support->surface_capabilities);
+    free(support->surface_formats);
+    free(support->present_modes);
+    free(support);
 }
 
 // Takes physical_device as a parameter because we have to be able to query this for any physical
@@ -317,7 +1139,7 @@ static vk_swapchain_support *query_swap_chain_support_details(VkPhysicalDevice p
 static bool is_device_suitable(vk_context *context, VkPhysicalDevice device,
                                VkPhysicalDeviceProperties *props)
 {
-    assert(context->surface != VK_NULL_HANDLE &&
+    assert((context->headless || context->surface != VK_NULL_HANDLE) &&
            "context->surface must be initialized before querying for physical device suitability");
     vk_init_device_queue_indices(context, device);
     if (!vk_queue_indices_is_suitable(&context->queue_indices))
@@ -325,41 +1147,69 @@ static bool is_device_suitable(vk_context *context, VkPhysicalDevice device,
         return false;
     }
 
-    // check for swapchain support:
-    uint32_t device_extension_count;
-    vk_checked(vkEnumerateDeviceExtensionProperties(device, NULL, &device_extension_count, NULL));
-    VkExtensionProperties device_extension_props[device_extension_count];
-    vk_checked(vkEnumerateDeviceExtensionProperties(device, NULL, &device_extension_count,
-                                                    device_extension_props));
+    // the uploader needs timeline semaphores, which are core (but optional) in 1.2:
+    if (props->apiVersion < VK_API_VERSION_1_2)
+    {
+        dbg("device %s only supports vulkan 1.%d\n", props->deviceName,
+            VK_API_VERSION_MINOR(props->apiVersion));
+        return false;
+    }
 
-    // query for swapchain support among the device extensions:
-    bool found = false;
-    for (uint32_t i = 0; i < device_extension_count; i++)
+    VkPhysicalDeviceVulkan12Features features_12 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    };
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &features_12,
+    };
+    vkGetPhysicalDeviceFeatures2(device, &features);
+    if (!features_12.timelineSemaphore)
     {
-        VkExtensionProperties props = device_extension_props[i];
-        if (strcmp(VK_KHR_SWAPCHAIN_EXTENSION_NAME, props.extensionName) == 0)
-        {
-            found = true;
-            break;
-        }
+        dbg("device %s does not support timeline semaphores\n", props->deviceName);
+        return false;
+    }
+    // ...and everything the bindless descriptor set needs (see vk_init_bindless), including
+    // indexing its arrays with values that aren't compile time constants at all:
+    if (!(features.features.shaderStorageBufferArrayDynamicIndexing &&
+          features.features.shaderSampledImageArrayDynamicIndexing &&
+          features_12.runtimeDescriptorArray && features_12.descriptorBindingPartiallyBound &&
+          features_12.descriptorBindingUpdateUnusedWhilePending &&
+          features_12.descriptorBindingStorageBufferUpdateAfterBind &&
+          features_12.descriptorBindingSampledImageUpdateAfterBind &&
+          features_12.shaderSampledImageArrayNonUniformIndexing))
+    {
+        dbg("device %s does not support bindless descriptor indexing\n", props->deviceName);
+        return false;
+    }
+
+    // in headless mode all we need is a graphics queue, so any device (including software
+    // rasterizers like lavapipe) will do:
+    if (context->headless)
+    {
+        return true;
     }
 
-    if (!found)
+    // check for swapchain support:
+    if (!device_extension_available(device, VK_KHR_SWAPCHAIN_EXTENSION_NAME))
     {
         dbg("device %s does not have swapchain support\n", props->deviceName);
         return false;
     }
 
-    // Note: we leak this struct if we return false.  I think this is fine for now. If the user has
-    // GPUs connected they also probably have enough RAM not to care about a few bytes here and
-    // there :sunglasses:
     vk_swapchain_support *support = query_swap_chain_support_details(device, context->surface);
+    if (context->swapchain_support != NULL)
+    {
+        // (from the last device we looked at)
+        free_swap_chain_support_details(context->swapchain_support);
+        context->swapchain_support = NULL;
+    }
 
     // For our purposes, the support is adequate if there is at least one supported image format
     // and one supported presentation mode given the window surface:
     if (support->surface_formats_count == 0 || support->present_modes_count == 0)
     {
         dbg("swap chain does not have 1 format or present mode for the given surface\n");
+        free_swap_chain_support_details(support);
         return false;
     }
 
@@ -370,38 +1220,237 @@ static bool is_device_suitable(vk_context *context, VkPhysicalDevice device,
     return true;
 }
 
-// Selects & validates a physical device:
-void vk_init_physical_device(vk_context *context)
+// How much we'd like to render on a device that is_device_suitable already said we can use.  The
+// device type matters most: a discrete GPU beats an integrated one (let alone llvmpipe) by more
+// than anything else here could make up for.  After that comes the size of the biggest device
+// local heap, then the optional features we make use of, then limits as a tie breaker.
+static uint64_t score_physical_device(VkPhysicalDevice device, VkPhysicalDeviceProperties *props)
+{
+    uint64_t score = 0;
+    switch (props->deviceType)
+    {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        score += 4000000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        score += 3000000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+        score += 2000000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+        break;
+    default:
+        score += 1000000;
+        break;
+    }
+
+    // 100 points per GiB:
+    VkPhysicalDeviceMemoryProperties memory;
+    vkGetPhysicalDeviceMemoryProperties(device, &memory);
+    VkDeviceSize heap_size = 0;
+    for (uint32_t i = 0; i < memory.memoryHeapCount; i++)
+    {
+        if ((memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) &&
+            memory.memoryHeaps[i].size > heap_size)
+        {
+            heap_size = memory.memoryHeaps[i].size;
+        }
+    }
+    score += heap_size * 100 / (1024ull * 1024 * 1024);
+
+    // 50 points per optional feature (see vk_init_logical_device for what they're for):
+    VkPhysicalDeviceVulkan12Features features_12 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    };
+    VkPhysicalDeviceVulkan13Features features_13 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+    };
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &features_12,
+    };
+    features_12.pNext = props->apiVersion >= VK_API_VERSION_1_3 ? &features_13 : NULL;
+    vkGetPhysicalDeviceFeatures2(device, &features);
+    bool optional[] = {
+        features.features.multiDrawIndirect,
+        features_12.drawIndirectCount,
+        features_13.dynamicRendering && features_13.synchronization2,
+        features.features.textureCompressionBC || features.features.textureCompressionASTC_LDR ||
+            features.features.textureCompressionETC2,
+        features.features.shaderStorageImageWriteWithoutFormat,
+        device_extension_available(device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME),
+    };
+    for (uint32_t i = 0; i < sizeof(optional) / sizeof(bool); i++)
+    {
+        score += optional[i] ? 50 : 0;
+    }
+
+    // and a point per 1024 pixels of maximum image size:
+    score += props->limits.maxImageDimension2D / 1024;
+    return score;
+}
+
+// Formats a device UUID as 32 hex digits, the way --device / DEVICE_ENV_VAR accept it:
+static void format_device_uuid(const uint8_t uuid[VK_UUID_SIZE], char out[VK_UUID_SIZE * 2 + 1])
+{
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+    {
+        snprintf(out + i * 2, 3, "%02x", uuid[i]);
+    }
+}
+
+// Whether a device is the one `pattern` asks for: either its UUID (with or without dashes, in any
+// case), or any part of its name, ignoring case.
+static bool device_matches(const char *pattern, const char *name, const char *uuid)
+{
+    // (anything with more than a UUID's worth of digits can't be one, not even a prefix of one)
+    char digits[VK_UUID_SIZE * 2 + 1];
+    uint32_t digit_count = 0;
+    bool too_long = false;
+    for (const char *c = pattern; *c != '\0' && !too_long; c++)
+    {
+        if (*c == '-')
+        {
+            continue;
+        }
+        too_long = digit_count == VK_UUID_SIZE * 2;
+        if (!too_long)
+        {
+            digits[digit_count++] = (char)tolower((unsigned char)*c);
+        }
+    }
+    digits[digit_count] = '\0';
+    if (!too_long && strcmp(digits, uuid) == 0)
+    {
+        return true;
+    }
+
+    size_t length = strlen(pattern);
+    for (const char *start = name; *start != '\0'; start++)
+    {
+        if (strncasecmp(start, pattern, length) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Selects & validates a physical device: the suitable one with the best score_physical_device, or
+// if `device_override` (--device) or DEVICE_ENV_VAR is set, the suitable one it matches.
+void vk_init_physical_device(vk_context *context, const char *device_override)
 {
     assert(context->instance &&
            "context must have instance set before calling vk_init_physical_device");
 
+    if (device_override == NULL)
+    {
+        device_override = getenv(DEVICE_ENV_VAR);
+    }
+    // an empty pattern would match every name, so `VULKAN_DEMO_DEVICE=` means the same as unset:
+    if (device_override != NULL && device_override[0] == '\0')
+    {
+        device_override = NULL;
+    }
+
     uint32_t device_count;
     vk_checked(vkEnumeratePhysicalDevices(context->instance, &device_count, NULL));
     VkPhysicalDevice devices[device_count];
     vk_checked(vkEnumeratePhysicalDevices(context->instance, &device_count, devices));
 
     VkPhysicalDevice the_chosen_one = VK_NULL_HANDLE;
+    uint64_t best_score = 0;
     for (uint32_t i = 0; i < device_count; i++)
     {
         VkPhysicalDevice curr_device = devices[i];
-        VkPhysicalDeviceProperties props;
-        vkGetPhysicalDeviceProperties(curr_device, &props);
-        if (is_device_suitable(context, curr_device, &props))
+        VkPhysicalDeviceIDProperties id_props = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+        };
+        VkPhysicalDeviceProperties2 props2 = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &id_props,
+        };
+        vkGetPhysicalDeviceProperties2(curr_device, &props2);
+        VkPhysicalDeviceProperties *props = &props2.properties;
+        char uuid[VK_UUID_SIZE * 2 + 1];
+        format_device_uuid(id_props.deviceUUID, uuid);
+
+        if (!is_device_suitable(context, curr_device, props))
+        {
+            continue;
+        }
+        if (device_override != NULL)
+        {
+            if (device_matches(device_override, props->deviceName, uuid))
+            {
+                dbg("device %s (%s) matches %s\n", props->deviceName, uuid, device_override);
+                the_chosen_one = curr_device;
+                break;
+            }
+            dbg("skipping device %s (%s): doesn't match %s\n", props->deviceName, uuid,
+                device_override);
+            continue;
+        }
+
+        uint64_t score = score_physical_device(curr_device, props);
+        dbg("device %s (%s) scores %llu\n", props->deviceName, uuid, (unsigned long long)score);
+        if (the_chosen_one == VK_NULL_HANDLE || score > best_score)
         {
-            dbg("selecting device: %s\n", props.deviceName);
             the_chosen_one = curr_device;
-            break;
+            best_score = score;
         }
     }
 
     if (the_chosen_one == VK_NULL_HANDLE)
     {
-        dbg("fatal: could not select suitable GPU device\n");
+        if (device_override != NULL)
+        {
+            dbg("fatal: no suitable GPU device matches %s\n", device_override);
+        }
+        else
+        {
+            dbg("fatal: could not select suitable GPU device\n");
+        }
         exit(1);
     }
 
     context->physical_device = the_chosen_one;
+    vkGetPhysicalDeviceProperties(the_chosen_one, &context->physical_device_props);
+    // is_device_suitable leaves the queue indices and swapchain support of the last device it
+    // looked at in the context, which isn't necessarily the one we picked:
+    is_device_suitable(context, the_chosen_one, &context->physical_device_props);
+    dbg("selecting device: %s\n", context->physical_device_props.deviceName);
+
+    // Pick the texture format family: the formats all have to be sampleable with linear filtering,
+    // and the feature that goes with them is what makes using them legal at all.
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(the_chosen_one, &features);
+    VkBool32 compression_features[TEXTURE_COMPRESSIONS_LEN] = {
+        features.textureCompressionBC,
+        features.textureCompressionASTC_LDR,
+        features.textureCompressionETC2,
+    };
+    for (uint32_t i = 0; i < TEXTURE_COMPRESSIONS_LEN; i++)
+    {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(the_chosen_one, texture_compressions[i].format, &props);
+        VkFormatFeatureFlags wanted =
+            VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if (compression_features[i] && (props.optimalTilingFeatures & wanted) == wanted)
+        {
+            context->texture_compression = &texture_compressions[i];
+            break;
+        }
+    }
+    if (context->texture_compression != NULL)
+    {
+        dbg("using %s compressed textures\n", context->texture_compression->suffix);
+    }
+    else
+    {
+        dbg("device has no compressed texture formats we know about\n");
+    }
     dbg("succesfully created physical device\n");
 }
 
@@ -410,14 +1459,24 @@ void vk_init_logical_device(vk_context *context)
     assert(context->physical_device != VK_NULL_HANDLE &&
            "context physical device must be initialized before initing logical device");
 
-    // handle the case that graphics & presentation queue are different indices:
-    uint32_t queue_family_length = 2;
-    uint32_t queue_families[] = {context->queue_indices.graphics,
-                                 context->queue_indices.presentation};
-
-    if (queue_families[0] == queue_families[1])
+    // graphics, presentation and transfer may or may not be the same families, and we can only ask
+    // for each family once:
+    uint32_t queue_family_length = 0;
+    uint32_t queue_families[3];
+    int32_t wanted_families[] = {context->queue_indices.graphics,
+                                 context->queue_indices.presentation,
+                                 context->queue_indices.transfer};
+    for (uint32_t i = 0; i < 3; i++)
     {
-        queue_family_length = 1;
+        bool seen = false;
+        for (uint32_t j = 0; j < queue_family_length; j++)
+        {
+            seen |= queue_families[j] == (uint32_t)wanted_families[i];
+        }
+        if (!seen)
+        {
+            queue_families[queue_family_length++] = wanted_families[i];
+        }
     }
 
     float queue_priority = 1.0;
@@ -433,24 +1492,100 @@ void vk_init_logical_device(vk_context *context)
         };
     }
 
-    // If we needed specific features like geometry shaders, we would enable them here, but for now
-    // just passing an empty struct:
+    // Optional features: we turn on the ones --gpu-cull wants if the device has them.
+    VkPhysicalDeviceVulkan12Features supported_12 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    };
+    VkPhysicalDeviceFeatures2 supported = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supported_12,
+    };
+    // (the 1.3 feature struct can only be chained in on 1.3 devices)
+    VkPhysicalDeviceVulkan13Features supported_13 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+    };
+    bool vulkan_13 = context->physical_device_props.apiVersion >= VK_API_VERSION_1_3;
+    supported_12.pNext = vulkan_13 ? &supported_13 : NULL;
+    vkGetPhysicalDeviceFeatures2(context->physical_device, &supported);
+    context->multi_draw_indirect = supported.features.multiDrawIndirect;
+    context->draw_indirect_count = context->multi_draw_indirect && supported_12.drawIndirectCount;
+    if (context->dynamic_rendering &&
+        !(supported_13.dynamicRendering && supported_13.synchronization2))
+    {
+        dbg("device doesn't support dynamic rendering + synchronization2, using a render pass\n");
+        context->dynamic_rendering = false;
+    }
+
     VkPhysicalDeviceFeatures features;
     // QUESTION: not sure if I need to do this?  the CPP example I'm following uses .{} and I don't
     // want this struct full of random stack memory
     memset(&features, 0, sizeof(VkPhysicalDeviceFeatures));
+    features.multiDrawIndirect = context->multi_draw_indirect;
+    // checked for in is_device_suitable (the bindless arrays are indexed from push constants and
+    // per-frame uniforms):
+    features.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+    features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+    // Textures can be in any block compressed format the device has, not just the one
+    // vk_init_physical_device prefers, and none of them may be used without their feature:
+    features.textureCompressionBC = supported.features.textureCompressionBC;
+    features.textureCompressionASTC_LDR = supported.features.textureCompressionASTC_LDR;
+    features.textureCompressionETC2 = supported.features.textureCompressionETC2;
+    context->storage_write_without_format =
+        supported.features.shaderStorageImageWriteWithoutFormat;
+    features.shaderStorageImageWriteWithoutFormat = context->storage_write_without_format;
+
+    uint32_t extension_count = 0;
+    const char *extension_names[MAX_LOGIC_DEV_EXT_LEN];
+    if (!context->headless)
+    {
+        extension_names[extension_count++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+    }
+    // the spec says we must enable this if the device advertises it (i.e. MoltenVK), and it doesn't
+    // exist anywhere else:
+    if (device_extension_available(context->physical_device, VK_KHR_PORTABILITY_SUBSET_EXT_NAME))
+    {
+        extension_names[extension_count++] = VK_KHR_PORTABILITY_SUBSET_EXT_NAME;
+    }
+    // lets the texture streamer size its budget to what's actually free:
+    context->memory_budget =
+        device_extension_available(context->physical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (context->memory_budget)
+    {
+        extension_names[extension_count++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    }
+
+    VkPhysicalDeviceVulkan13Features features_13 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+        .synchronization2 = VK_TRUE,
+        .dynamicRendering = VK_TRUE,
+    };
+    // checked for in is_device_suitable:
+    VkPhysicalDeviceVulkan12Features features_12 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = context->dynamic_rendering ? &features_13 : NULL,
+        .timelineSemaphore = VK_TRUE,
+        .drawIndirectCount = context->draw_indirect_count,
+        .runtimeDescriptorArray = VK_TRUE,
+        .descriptorBindingPartiallyBound = VK_TRUE,
+        .descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
+        .descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE,
+        .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+        .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+    };
+
     VkDeviceCreateInfo device_create_info = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &features_12,
         .pQueueCreateInfos = queue_create_infos,
         .queueCreateInfoCount = queue_family_length,
         .pEnabledFeatures = &features,
-        .enabledLayerCount = REQUIRED_LOGIC_DEV_LAYERS_LEN,
-        .ppEnabledLayerNames = required_logic_dev_layers_names,
-        .enabledExtensionCount = REQUIRED_LOGIC_DEV_EXT_LEN,
-        .ppEnabledExtensionNames = required_logic_dev_ext_names,
+        // (device layers are deprecated, but older loaders want the instance's layers here too)
+        .enabledLayerCount = context->layer_count,
+        .ppEnabledLayerNames = context->layers,
+        .enabledExtensionCount = extension_count,
+        .ppEnabledExtensionNames = extension_names,
     };
-    dbg_str_array(required_logic_dev_ext_names, REQUIRED_LOGIC_DEV_EXT_LEN,
-                  "enabling logical device extension %s\n");
+    dbg_str_array(extension_names, extension_count, "enabling logical device extension %s\n");
 
     VkDevice logical_device;
     vk_checked(
@@ -482,763 +1617,5982 @@ void vk_init_queue_handles(vk_context *context)
         VkQueue presentation;
         vkGetDeviceQueue(context->logical_device, context->queue_indices.presentation, 0,
                          &presentation);
-        context->graphics_queue = presentation;
+        context->presentation_queue = presentation;
     }
 
+    // (if transfer is the graphics family this is just the graphics queue again)
+    vkGetDeviceQueue(context->logical_device, context->queue_indices.transfer, 0,
+                     &context->transfer_queue);
+
     dbg("successfully retrieved queue handles for logical device\n");
 }
 
-static VkSurfaceFormatKHR choose_swapchain_surface_format(vk_context *context)
+// Picks a memory type allowed by `type_bits` (from VkMemoryRequirements) that has all of the
+// `required` property flags, preferring one that also has the `preferred` flags.  Returns
+// UINT32_MAX if there isn't one.
+static uint32_t vk_find_memory_type(vk_context *context, uint32_t type_bits,
+                                    VkMemoryPropertyFlags required,
+                                    VkMemoryPropertyFlags preferred)
 {
-    vk_swapchain_support *support = context->swapchain_support;
-    // choose swap surface format:
-    bool found_format = false;
-    VkSurfaceFormatKHR chosen_format;
-    for (uint32_t i = 0; i < support->surface_formats_count; i++)
+    VkPhysicalDeviceMemoryProperties *mem_props = &context->allocator.memory_props;
+    VkMemoryPropertyFlags wanted[] = {required | preferred, required};
+
+    for (uint32_t pass = 0; pass < 2; pass++)
     {
-        VkSurfaceFormatKHR iter_format = support->surface_formats[i];
-        if (iter_format.format == VK_FORMAT_B8G8R8A8_SRGB &&
-            iter_format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+        for (uint32_t i = 0; i < mem_props->memoryTypeCount; i++)
         {
-            chosen_format = iter_format;
-            found_format = true;
-            break;
+            if ((type_bits & (1 << i)) &&
+                (mem_props->memoryTypes[i].propertyFlags & wanted[pass]) == wanted[pass])
+            {
+                return i;
+            }
         }
     }
 
-    // if we made it through the loop and we didn't find one, just pick the first one:
-    // remember that we are guaranteed to have at least one format
-    if (!found_format)
-    {
-        chosen_format = support->surface_formats[0];
-    }
-
-    return chosen_format;
+    return UINT32_MAX;
 }
 
-static VkPresentModeKHR choose_presentation_mode(vk_context *context)
+void vk_init_allocator(vk_context *context)
 {
-    vk_swapchain_support *support = context->swapchain_support;
-    bool found_format = false;
-    VkPresentModeKHR chosen_mode;
+    assert(context->logical_device != VK_NULL_HANDLE &&
+           "context->logical_device must be initialized before the allocator");
+    vkGetPhysicalDeviceMemoryProperties(context->physical_device,
+                                        &context->allocator.memory_props);
+    context->allocator.block_count = 0;
+    context->allocator.dedicated_count = 0;
+    context->allocator.dedicated_bytes = 0;
+    dbg("successfully initialized allocator with %d memory types\n",
+        context->allocator.memory_props.memoryTypeCount);
+}
 
-    for (uint32_t i = 0; i < support->present_modes_count; i++)
+static VkDeviceMemory vk_allocate_device_memory(vk_context *context, VkDeviceSize size,
+                                                uint32_t memory_type, void **mapped)
+{
+    vk_allocator *allocator = &context->allocator;
+    uint32_t allocation_count = allocator->block_count + allocator->dedicated_count;
+    if (allocation_count >= context->physical_device_props.limits.maxMemoryAllocationCount)
     {
-        VkPresentModeKHR available = support->present_modes[i];
-        if (available == VK_PRESENT_MODE_MAILBOX_KHR)
-        {
-            dbg("chose presentation mode: VK_PRESENT_MODE_MAILBOX_KHR\n");
-            found_format = true;
-            chosen_mode = available;
-        }
+        dbg("fatal: hit maxMemoryAllocationCount (%d)\n", allocation_count);
+        exit(1);
     }
 
-    // only VK_PRESENT_MODE_FIFO_KHR is guaranteed to be available, but we will try to select
-    // VK_PRESENT_MODE_MAILFIX_KHR if we can
-    if (!found_format)
+    VkMemoryAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = size,
+        .memoryTypeIndex = memory_type,
+    };
+    VkDeviceMemory memory;
+    vk_checked(vkAllocateMemory(context->logical_device, &alloc_info, NULL, &memory));
+
+    *mapped = NULL;
+    if (allocator->memory_props.memoryTypes[memory_type].propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
     {
-        dbg("chose presentation mode: VK_PRESENT_MODE_FIFO_KHR\n");
-        chosen_mode = VK_PRESENT_MODE_FIFO_KHR;
+        vk_checked(vkMapMemory(context->logical_device, memory, 0, VK_WHOLE_SIZE, 0, mapped));
     }
 
-    return chosen_mode;
+    return memory;
 }
 
-uint32_t clamp(uint32_t value, uint32_t lb, uint32_t ub)
+static void block_push_free(vk_memory_block *block, uint32_t order, VkDeviceSize offset)
 {
-    // cmp w0, w1
-    // csel w8, w0, w1, HI
-    // etc
-    uint32_t t = value < lb ? lb : value;
-    return t > ub ? ub : value;
+    if (block->free_counts[order] == block->free_caps[order])
+    {
+        uint32_t new_cap = block->free_caps[order] == 0 ? 8 : block->free_caps[order] * 2;
+        block->free_lists[order] =
+            realloc(block->free_lists[order], new_cap * sizeof(VkDeviceSize));
+        if (block->free_lists[order] == NULL)
+        {
+            dbg("unable to grow allocator free list: OOM\n");
+            exit(1);
+        }
+        block->free_caps[order] = new_cap;
+    }
+    block->free_lists[order][block->free_counts[order]++] = offset;
 }
 
-VkExtent2D choose_swap_extent(vk_context *context)
+// Removes `offset` from the free list for `order`, returning false if it wasn't in there (i.e.
+// that buddy is in use).
+static bool block_remove_free(vk_memory_block *block, uint32_t order, VkDeviceSize offset)
 {
-    VkSurfaceCapabilitiesKHR *capabilities = context->swapchain_support->surface_capabilities;
-    // If the window manager allows us to not specify the current extent as the resolution of the
-    // window, then it will set currentExtent to UINT32_MAX, and then it's on us to set the width
-    // and height in pixels based on the minimum and maximum image extent
-    if (capabilities->currentExtent.width != UINT32_MAX)
+    for (uint32_t i = 0; i < block->free_counts[order]; i++)
     {
-        return capabilities->currentExtent;
+        if (block->free_lists[order][i] == offset)
+        {
+            block->free_lists[order][i] = block->free_lists[order][--block->free_counts[order]];
+            return true;
+        }
     }
+    return false;
+}
 
-    int width, height;
-    SDL_Vulkan_GetDrawableSize(context->window, &width, &height);
+static bool block_alloc(vk_memory_block *block, uint32_t order, VkDeviceSize *offset)
+{
+    // find the smallest free buddy that's big enough:
+    uint32_t found = order;
+    while (found < ALLOC_ORDERS && block->free_counts[found] == 0)
+    {
+        found++;
+    }
+    if (found == ALLOC_ORDERS)
+    {
+        return false;
+    }
 
-    VkExtent2D extent = {
-        .width = (uint32_t)width,
-        .height = (uint32_t)height,
-    };
+    *offset = block->free_lists[found][--block->free_counts[found]];
 
-    extent.width =
-        clamp(extent.width, capabilities->minImageExtent.width, capabilities->maxImageExtent.width);
-    extent.height = clamp(extent.height, capabilities->minImageExtent.height,
-                          capabilities->maxImageExtent.height);
+    // and split it in half until it's the size we want, freeing the upper halves as we go:
+    while (found > order)
+    {
+        found--;
+        block_push_free(block, found, *offset + (1ull << (found + ALLOC_MIN_SIZE_LOG2)));
+    }
 
-    return extent;
+    block->used += 1ull << (order + ALLOC_MIN_SIZE_LOG2);
+    return true;
 }
 
-void vk_init_swap_chain(vk_context *context)
+static void block_free(vk_memory_block *block, uint32_t order, VkDeviceSize offset)
 {
-    assert(context->swapchain_support &&
-           "context->swapchain_support must be initialized before initing swap chain");
-    VkSurfaceFormatKHR surface_format = choose_swapchain_surface_format(context);
-    VkPresentModeKHR present_mode = choose_presentation_mode(context);
-    VkExtent2D extent = choose_swap_extent(context);
-
-    VkSurfaceCapabilitiesKHR *capabilities = context->swapchain_support->surface_capabilities;
-    // choose how many images we want to have in the swap chain (1 more than the minimum):
-    uint32_t image_count = capabilities->minImageCount + 1;
+    block->used -= 1ull << (order + ALLOC_MIN_SIZE_LOG2);
 
-    // make sure we are not exceeding the maximum (where 0 means there is no maximum)
-    if (capabilities->maxImageCount > 0 && image_count > capabilities->maxImageCount)
+    // merge with our buddy for as long as it's also free:
+    while (order + 1 < ALLOC_ORDERS)
     {
-        image_count = capabilities->maxImageCount;
+        VkDeviceSize buddy = offset ^ (1ull << (order + ALLOC_MIN_SIZE_LOG2));
+        if (!block_remove_free(block, order, buddy))
+        {
+            break;
+        }
+        offset = offset < buddy ? offset : buddy;
+        order++;
     }
-    dbg("creating swapchain with %d min images\n", image_count);
-
-    VkSwapchainCreateInfoKHR create_info = {
-        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-        .surface = context->surface,
-        .minImageCount = image_count,
-        .imageFormat = surface_format.format,
-        .imageColorSpace = surface_format.colorSpace,
-        .imageExtent = extent,
-        .imageArrayLayers = 1,
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-        // No pre-transformation of images:
-        .preTransform = capabilities->currentTransform,
-        // the alpha channel used for blending with other windows (ignored here):
-        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-        .presentMode = present_mode,
-        // we don't care about the color of pixels that are obscured:
-        .clipped = VK_TRUE,
-        // for now leave this null...eventually we will need to handle this to re-create the
-        // swapchain
-        .oldSwapchain = VK_NULL_HANDLE,
-    };
 
-    // set up queue sharing modes:
-    uint32_t queue_family_indices[] = {context->queue_indices.graphics,
-                                       context->queue_indices.presentation};
+    block_push_free(block, order, offset);
+}
 
-    if (context->queue_indices.graphics != context->queue_indices.presentation)
+// Sub-allocates memory that satisfies `reqs` from a memory type with the `required` (and ideally
+// the `preferred`) property flags.  `linear` is true for buffers and linearly tiled images.
+vk_allocation vk_alloc(vk_context *context, VkMemoryRequirements reqs, bool linear,
+                       VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred)
+{
+    vk_allocator *allocator = &context->allocator;
+    uint32_t memory_type = vk_find_memory_type(context, reqs.memoryTypeBits, required, preferred);
+    if (memory_type == UINT32_MAX)
     {
-        create_info.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-        create_info.queueFamilyIndexCount = 2;
-        create_info.pQueueFamilyIndices = queue_family_indices;
+        dbg("fatal: could not find memory type with properties %d\n", required);
+        exit(1);
     }
-    else
+
+    vk_allocation allocation = {.size = reqs.size, .block = -1, .order = 0};
+
+    // buddies are aligned to their own size, so rounding up to a power of two >= the alignment
+    // takes care of alignment for us:
+    VkDeviceSize needed = reqs.size > reqs.alignment ? reqs.size : reqs.alignment;
+    uint32_t order = 0;
+    while ((1ull << (order + ALLOC_MIN_SIZE_LOG2)) < needed)
     {
-        create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        create_info.queueFamilyIndexCount = 0;
-        create_info.pQueueFamilyIndices = NULL;
+        order++;
     }
 
-    VkSwapchainKHR swapchain;
-    vk_checked(vkCreateSwapchainKHR(context->logical_device, &create_info, NULL, &swapchain));
-    context->swapchain = swapchain;
-
-    dbg("sucessfully created swapchain \n");
+    if (order >= ALLOC_ORDERS)
+    {
+        // too big to sub-allocate:
+        allocation.memory =
+            vk_allocate_device_memory(context, reqs.size, memory_type, &allocation.mapped);
+        allocation.offset = 0;
+        allocator->dedicated_count++;
+        allocator->dedicated_bytes += reqs.size;
+        return allocation;
+    }
 
-    // get handles to the swap chain images:
-    uint32_t actual_image_count;
-    vkGetSwapchainImagesKHR(context->logical_device, context->swapchain, &actual_image_count, NULL);
+    for (uint32_t i = 0; i < allocator->block_count; i++)
+    {
+        vk_memory_block *block = &allocator->blocks[i];
+        if (block->memory_type == memory_type && block->linear == linear &&
+            block_alloc(block, order, &allocation.offset))
+        {
+            allocation.block = i;
+            break;
+        }
+    }
 
-    VkImage *images = calloc(actual_image_count, sizeof(VkImage));
-    vkGetSwapchainImagesKHR(context->logical_device, context->swapchain, &actual_image_count,
-                            images);
+    if (allocation.block == -1)
+    {
+        if (allocator->block_count == ALLOC_MAX_BLOCKS)
+        {
+            dbg("fatal: allocator is out of blocks (ALLOC_MAX_BLOCKS = %d)\n", ALLOC_MAX_BLOCKS);
+            exit(1);
+        }
 
-    context->swapchain_images = images;
-    context->swapchain_image_count = actual_image_count;
-    context->swapchain_image_format = surface_format.format;
-    context->swapchain_extent = extent;
+        vk_memory_block *block = &allocator->blocks[allocator->block_count];
+        memset(block, 0, sizeof(vk_memory_block));
+        block->memory = vk_allocate_device_memory(context, ALLOC_BLOCK_SIZE, memory_type,
+                                                  &block->mapped);
+        block->memory_type = memory_type;
+        block->linear = linear;
+        // a brand new block is a single free buddy of the largest order:
+        block_push_free(block, ALLOC_ORDERS - 1, 0);
+        dbg("allocated memory block %d (memory type %d, %s)\n", allocator->block_count,
+            memory_type, linear ? "linear" : "optimal");
+
+        block_alloc(block, order, &allocation.offset);
+        allocation.block = allocator->block_count++;
+    }
 
-    dbg("retrieved swapchain image handles with count = %d\n", actual_image_count);
+    vk_memory_block *block = &allocator->blocks[allocation.block];
+    block->requested += reqs.size;
+    allocation.memory = block->memory;
+    allocation.order = order;
+    allocation.mapped = block->mapped ? (char *)block->mapped + allocation.offset : NULL;
+    return allocation;
 }
 
-void vk_init_image_views(vk_context *context)
+void vk_free(vk_context *context, vk_allocation *allocation)
 {
-    VkImageView *image_views = calloc(context->swapchain_image_count, sizeof(VkImageView));
-    for (uint32_t i = 0; i < context->swapchain_image_count; i++)
+    vk_allocator *allocator = &context->allocator;
+    if (allocation->block == -1)
     {
-        VkImageViewCreateInfo create_info = {.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-                                             .image = context->swapchain_images[i],
-                                             .viewType = VK_IMAGE_VIEW_TYPE_2D,
-                                             .format = context->swapchain_image_format,
-                                             .components =
-                                                 (VkComponentMapping){
-                                                     .r = VK_COMPONENT_SWIZZLE_IDENTITY,
-                                                     .g = VK_COMPONENT_SWIZZLE_IDENTITY,
-                                                     .b = VK_COMPONENT_SWIZZLE_IDENTITY,
-                                                     .a = VK_COMPONENT_SWIZZLE_IDENTITY,
-                                                 },
-                                             .subresourceRange =
-                                                 (VkImageSubresourceRange){
-                                                     .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                                                     .baseMipLevel = 0,
-                                                     .levelCount = 1,
-                                                     .baseArrayLayer = 0,
-                                                     .layerCount = 1,
-                                                 }
+        vkFreeMemory(context->logical_device, allocation->memory, NULL);
+        allocator->dedicated_count--;
+        allocator->dedicated_bytes -= allocation->size;
+    }
+    else
+    {
+        vk_memory_block *block = &allocator->blocks[allocation->block];
+        block->requested -= allocation->size;
+        block_free(block, allocation->order, allocation->offset);
+    }
 
-        };
+    memset(allocation, 0, sizeof(vk_allocation));
+}
 
-        vk_checked(vkCreateImageView(context->logical_device, &create_info, NULL, &image_views[i]));
-    }
+// Creates a buffer and binds it to freshly sub-allocated memory:
+void vk_create_buffer(vk_context *context, VkDeviceSize size, VkBufferUsageFlags usage,
+                      VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+                      VkBuffer *buffer, vk_allocation *allocation)
+{
+    VkBufferCreateInfo buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    vk_checked(vkCreateBuffer(context->logical_device, &buffer_info, NULL, buffer));
 
-    context->image_views_count = context->swapchain_image_count;
-    context->image_views = image_views;
-    dbg("successfully initialized image views\n");
+    VkMemoryRequirements reqs;
+    vkGetBufferMemoryRequirements(context->logical_device, *buffer, &reqs);
+    *allocation = vk_alloc(context, reqs, true, required, preferred);
+    vk_checked(vkBindBufferMemory(context->logical_device, *buffer, allocation->memory,
+                                  allocation->offset));
 }
 
-typedef struct shader_read_result
+// Creates an image and binds it to freshly sub-allocated memory:
+void vk_create_image(vk_context *context, const VkImageCreateInfo *image_info,
+                     VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+                     VkImage *image, vk_allocation *allocation)
 {
-    char *code;
-    size_t size;
-    size_t cap;
-} shader_read_result;
+    vk_checked(vkCreateImage(context->logical_device, image_info, NULL, image));
+
+    VkMemoryRequirements reqs;
+    vkGetImageMemoryRequirements(context->logical_device, *image, &reqs);
+    *allocation = vk_alloc(context, reqs, image_info->tiling == VK_IMAGE_TILING_LINEAR, required,
+                           preferred);
+    vk_checked(vkBindImageMemory(context->logical_device, *image, allocation->memory,
+                                 allocation->offset));
+}
 
-shader_read_result read_shader_code(const char *path)
+vk_allocator_stats vk_allocator_get_stats(vk_context *context)
 {
-    shader_read_result result = {
-        // I'm not sure I actually need to do this...maybe I could just malloc()...but the spec
-        // says that malloc only guarantees alignment for objects of <type>, so like, it could
-        // return a 2-aligned address that would break my uint32_t* cast later on right?
-        .code = aligned_alloc(alignof(void *), 1024),
-        .size = 0,
-        .cap = 1024,
+    vk_allocator *allocator = &context->allocator;
+    vk_allocator_stats stats = {
+        .block_count = allocator->block_count,
+        .dedicated_count = allocator->dedicated_count,
+        .bytes_allocated = allocator->block_count * ALLOC_BLOCK_SIZE + allocator->dedicated_bytes,
+        .bytes_used = allocator->dedicated_bytes,
+        .bytes_requested = allocator->dedicated_bytes,
     };
 
-    if (result.code == NULL)
-    {
-        dbg("could not allocate %d bytes of memory with alignment %lu: %s\n", 1024,
-            alignof(uint32_t), strerror(errno));
-        exit(1);
-    }
-
-    FILE *file = fopen(path, "rb");
-    if (file == NULL)
+    VkDeviceSize total_free = 0;
+    for (uint32_t i = 0; i < allocator->block_count; i++)
     {
-        dbg("could not read shader file at path %s: %s\n", path, strerror(errno));
-        exit(1);
-    }
+        vk_memory_block *block = &allocator->blocks[i];
+        stats.bytes_used += block->used;
+        stats.bytes_requested += block->requested;
+        total_free += ALLOC_BLOCK_SIZE - block->used;
 
-    for (;;)
-    {
-        // potentially resize code buffer:
-        if (result.size == result.cap)
+        for (int32_t order = ALLOC_ORDERS - 1; order >= 0; order--)
         {
-            size_t new_size = result.cap * 2;
-            dbg("(%s): resizing code buffer from %lu to %lu\n", path, result.cap, new_size);
-            result.code = realloc(result.code, new_size);
-
-            if (result.code == NULL)
+            VkDeviceSize size = 1ull << (order + ALLOC_MIN_SIZE_LOG2);
+            if (block->free_counts[order] > 0 && size > stats.largest_free)
             {
-                dbg("unable to realloc code buffer: OOM\n");
-                exit(1);
+                stats.largest_free = size;
+                break;
             }
-
-            result.cap = new_size;
         }
+    }
 
-        size_t requested_bytes = result.cap - result.size;
-        size_t bytes_read = fread(result.code + result.size, 1, requested_bytes, file);
-        result.size = result.size + bytes_read;
+    stats.fragmentation =
+        total_free > 0 ? 1.0 - (double)stats.largest_free / (double)total_free : 0.0;
+    return stats;
+}
 
-        if (bytes_read < requested_bytes)
-        {
-            break;
-        }
-    }
+void vk_init_frame_arena(vk_context *context)
+{
+    vk_frame_arena *arena = &context->frame_arena;
+    // host visible so we can write straight into it, and device local too if the device has memory
+    // that's both (resizable BAR / integrated GPUs) so the GPU doesn't read it over the bus:
+    vk_create_buffer(context, FRAME_ARENA_SIZE * MAX_FRAMES_IN_FLIGHT,
+                     VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                         VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &arena->buffer, &arena->allocation);
+    arena->frame = 0;
+    arena->head = 0;
+    arena->high_water = 0;
+    dbg("successfully initialized frame arena\n");
+}
 
-    // If the read that broke the loop was an error, crash:
-    if (ferror(file))
+// Starts handing out memory from `frame`'s region again.  Only safe once the GPU has finished the
+// last frame that used that slot.
+void vk_frame_arena_reset(vk_context *context, uint32_t frame)
+{
+    vk_frame_arena *arena = &context->frame_arena;
+    if (arena->head > arena->high_water)
     {
-        dbg("error reading from file stream: %s\n", strerror(errno));
-        exit(1);
+        arena->high_water = arena->head;
     }
-
-    dbg("successfully read %lu bytes of shader bytecode from %s\n", result.size, path);
-    return result;
+    arena->frame = frame;
+    arena->head = 0;
 }
 
-VkShaderModule create_shader_module(vk_context *context, size_t code_size, char *code)
+// Bump-allocates `size` bytes of per-frame scratch memory that stays valid until this frame slot
+// comes around again.
+vk_transient_alloc vk_frame_alloc(vk_context *context, VkDeviceSize size, VkDeviceSize alignment)
 {
-    VkShaderModule mod;
-    VkShaderModuleCreateInfo create_info = {.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-                                            .codeSize = code_size,
-                                            .pCode = (uint32_t *)code};
-    vk_checked(vkCreateShaderModule(context->logical_device, &create_info, NULL, &mod));
+    vk_frame_arena *arena = &context->frame_arena;
+    VkDeviceSize head = (arena->head + alignment - 1) / alignment * alignment;
+    if (head + size > FRAME_ARENA_SIZE)
+    {
+        dbg("fatal: frame arena exhausted (%llu bytes requested, FRAME_ARENA_SIZE = %llu)\n",
+            (unsigned long long)size, (unsigned long long)FRAME_ARENA_SIZE);
+        exit(1);
+    }
+    arena->head = head + size;
 
-    return mod;
+    VkDeviceSize offset = arena->frame * FRAME_ARENA_SIZE + head;
+    return (vk_transient_alloc){
+        .buffer = arena->buffer,
+        .offset = offset,
+        .data = (char *)arena->allocation.mapped + offset,
+    };
 }
 
-void vk_init_graphics_pipeline(vk_context *context)
+// Uploads to device local memory go through a host visible ring buffer: data is memcpy'd into the
+// ring, a copy out of it is recorded into the current upload batch, and batches are submitted to
+// the transfer queue.  Each batch signals the next value of a timeline semaphore, which tells us
+// both when its part of the ring can be reused and what the graphics queue has to wait for before
+// touching what it uploaded.
+void vk_init_uploader(vk_context *context)
 {
-    assert(context->render_pass != VK_NULL_HANDLE &&
-           "expected context->render_pass to be initialized befoore creating graphics pipeline");
-    // load our shaders:
-    shader_read_result vert_shader = read_shader_code("shaders/shader.vert.spv");
-    shader_read_result frag_shader = read_shader_code("shaders/shader.frag.spv");
+    vk_uploader *uploader = &context->uploader;
+    uploader->queue_family = context->queue_indices.transfer;
+    uploader->queue = context->transfer_queue;
 
-    // create shader modules:
-    VkShaderModule vert_mod = create_shader_module(context, vert_shader.size, vert_shader.code);
-    VkShaderModule frag_mod = create_shader_module(context, frag_shader.size, frag_shader.code);
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                 VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = uploader->queue_family,
+    };
+    vk_checked(
+        vkCreateCommandPool(context->logical_device, &pool_info, NULL, &uploader->command_pool));
 
-    // create shader stages:
-    VkPipelineShaderStageCreateInfo vertex_shader_stage_create = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .stage = VK_SHADER_STAGE_VERTEX_BIT,
-        .module = vert_mod,
-        .pName = "main",
-        // Init any shader constants here:
-        .pSpecializationInfo = NULL,
+    VkCommandBufferAllocateInfo buffer_alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = uploader->command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
     };
+    for (uint32_t i = 0; i < UPLOAD_BATCHES; i++)
+    {
+        vk_upload_batch *batch = &uploader->batches[i];
+        vk_checked(vkAllocateCommandBuffers(context->logical_device, &buffer_alloc_info,
+                                            &batch->command_buffer));
+        batch->value = 0;
+        batch->ring_end = 0;
+        batch->pending = false;
+    }
 
-    VkPipelineShaderStageCreateInfo frag_shader_stage_create = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-        .module = frag_mod,
-        .pName = "main",
-        // Init any shader constants here:
-        .pSpecializationInfo = NULL,
+    VkSemaphoreTypeCreateInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+    VkSemaphoreCreateInfo semaphore_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &timeline_info,
     };
+    vk_checked(
+        vkCreateSemaphore(context->logical_device, &semaphore_info, NULL, &uploader->timeline));
+    uploader->timeline_value = 0;
+
+    vk_create_buffer(context, STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     0, &uploader->staging_buffer, &uploader->staging_allocation);
+    uploader->head = 0;
+    uploader->tail = 0;
+    uploader->current = 0;
+    uploader->recording = false;
+
+    uploader->releases = NULL;
+    uploader->releases_count = 0;
+    uploader->acquires = NULL;
+    uploader->acquires_count = 0;
+    uploader->ownership_capacity = 0;
+    uploader->acquire_value = 0;
+
+    dbg("successfully initialized uploader on queue family %d (graphics is %d)\n",
+        uploader->queue_family, context->queue_indices.graphics);
+}
 
-    VkPipelineShaderStageCreateInfo shader_stage_create_infos[] = {vertex_shader_stage_create,
-                                                                   frag_shader_stage_create};
+static bool vk_upload_needs_handoff(vk_context *context)
+{
+    return context->uploader.queue_family != (uint32_t)context->queue_indices.graphics;
+}
 
-    // configure fixed-function operations:
+// Moves the ring's tail past every batch the GPU has finished with.  If `wait` is set, blocks on
+// the oldest pending batch first.
+static void vk_upload_retire(vk_context *context, bool wait)
+{
+    vk_uploader *uploader = &context->uploader;
+    uint64_t completed;
+    vk_checked(vkGetSemaphoreCounterValue(context->logical_device, uploader->timeline, &completed));
 
-    // describe the format of the vertex data passed to vertex shader:
-    VkPipelineVertexInputStateCreateInfo vertex_input_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount = 0,
-        .pVertexBindingDescriptions = NULL,
-        .vertexAttributeDescriptionCount = 0,
-        .pVertexAttributeDescriptions = NULL,
-    };
+    // batches are submitted in order, so walking forwards from `current` (which is either being
+    // recorded or is the oldest one submitted) visits them oldest first:
+    for (uint32_t i = 0; i < UPLOAD_BATCHES; i++)
+    {
+        vk_upload_batch *batch = &uploader->batches[(uploader->current + i) % UPLOAD_BATCHES];
+        if (!batch->pending)
+        {
+            continue;
+        }
 
-    // describe the kind of geometry drawn from the vertices and if primitive restart should be
-    // enabled
-    VkPipelineInputAssemblyStateCreateInfo input_assembly_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-        .primitiveRestartEnable = VK_FALSE, // not required for non-strip topologies
-    };
-
-    VkViewport viewport = {
-        .x = 0.0f,
-        .y = 0.0f,
-        .width = context->swapchain_extent.width,
-        .height = context->swapchain_extent.height,
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f,
-    };
-
-    VkRect2D scissor = {
-        .offset =
-            (VkOffset2D){
-                .x = 0,
-                .y = 0,
-            },
-        .extent = context->swapchain_extent,
-    };
-
-    // If we _did_ want to set this dynamically, we could do it here:
-    // VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
-    // VkPipelineDynamicStateCreateInfo dynamic_state = {
-    //     .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-    //     .dynamicStateCount = 2,
-    //     .pDynamicStates = dynamic_states,
-    // };
+        if (wait && completed < batch->value)
+        {
+            VkSemaphoreWaitInfo wait_info = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                .semaphoreCount = 1,
+                .pSemaphores = &uploader->timeline,
+                .pValues = &batch->value,
+            };
+            vk_checked(vkWaitSemaphores(context->logical_device, &wait_info, UINT64_MAX));
+            completed = batch->value;
+        }
+        wait = false;
 
-    // Opting out of dynamic viewport and scissor state by specifying them directly:
-    VkPipelineViewportStateCreateInfo viewport_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-        .viewportCount = 1,
-        .pViewports = &viewport,
-        .scissorCount = 1,
-        .pScissors = &scissor,
-    };
+        if (completed < batch->value)
+        {
+            break;
+        }
 
-    VkPipelineRasterizationStateCreateInfo rasterizer_create_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-        // VK_TRUE = fragments beyond the near and far plans are clamped to them instead of
-        // discarding them (GPU feature required).
-        .depthClampEnable = VK_FALSE,
-        // VK_TRUE = geometry never passes through the rasterizer stage, disabling all output to
-        // the framebuffer
-        .rasterizerDiscardEnable = VK_FALSE,
-        // determines how fragments are generated for geometry (fill, line, or point)
-        .polygonMode = VK_POLYGON_MODE_FILL,
-        .lineWidth = 1.0f,
-        .cullMode = VK_CULL_MODE_BACK_BIT,
-        .frontFace = VK_FRONT_FACE_CLOCKWISE,
-        .depthBiasEnable = VK_FALSE,
-        // Sometimes adjusted for shadow mapping:
-        .depthBiasConstantFactor = 0.0f,
-        .depthBiasClamp = 0.0f,
-        .depthBiasSlopeFactor = 0.0f,
-    };
+        uploader->tail = batch->ring_end;
+        batch->pending = false;
+    }
+}
 
-    // keep multisampling disabled for now:
-    VkPipelineMultisampleStateCreateInfo multi_sampling = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-        .sampleShadingEnable = VK_FALSE,
-        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
-        .minSampleShading = 1.0f,
-        .pSampleMask = NULL,
-        .alphaToCoverageEnable = VK_FALSE,
-        .alphaToOneEnable = VK_FALSE,
-    };
+// Submits everything recorded since the last flush.
+void vk_upload_flush(vk_context *context)
+{
+    vk_uploader *uploader = &context->uploader;
+    if (!uploader->recording)
+    {
+        return;
+    }
 
-    // TODO: configure depth and stencil buffers:
+    vk_upload_batch *batch = &uploader->batches[uploader->current];
 
-    // color blending: turn off both modes so that fragment colors are passed through to the final
-    // image unmodified
-    // configure color blending for our 1 framebuffer:
-    VkPipelineColorBlendAttachmentState color_blend_attachment = {
-        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
-        .blendEnable = false,
-        .srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
-        .dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
-        .colorBlendOp = VK_BLEND_OP_ADD,
-        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
-        .alphaBlendOp = VK_BLEND_OP_ADD,
-    };
+    if (!vk_upload_needs_handoff(context))
+    {
+        // Same queue as the draws, so a barrier is enough to make the copies visible to them.  A
+        // barrier covers all commands before / after it in submission order, not just the ones in
+        // this command buffer, so the draws in later frames don't need to do anything.
+        VkMemoryBarrier barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                             VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
+        };
+        vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             UPLOAD_CONSUMER_STAGES, 0, 1, &barrier, 0, NULL, 0, NULL);
+    }
+    else if (uploader->releases_count > 0)
+    {
+        // The buffers are exclusive to one queue family, so the transfer queue has to release
+        // them and the graphics queue acquire them (in vk_upload_acquire) before they're usable.
+        // The release half only needs to make the writes available, the acquire half does the
+        // visibility part.
+        vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL,
+                             uploader->releases_count, uploader->releases, 0, NULL);
+    }
+    vk_checked(vkEndCommandBuffer(batch->command_buffer));
 
-    // set constants to be used in the operations described by the blend attachment:
-    VkPipelineColorBlendStateCreateInfo color_blend_state = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-        .logicOpEnable = VK_FALSE,
-        .logicOp = VK_LOGIC_OP_COPY,
-        .attachmentCount = 1,
-        .pAttachments = &color_blend_attachment,
-        .blendConstants = {0.0f, 0.0f, 0.0f, 0.0f},
+    batch->value = ++uploader->timeline_value;
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &batch->value,
     };
-
-    // create the pipeline
-    // specify uniform values for the pipeline via the pipeline layout:
-    VkPipelineLayout pipeline_layout;
-    VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 0,
-        .pSetLayouts = NULL,
-        .pushConstantRangeCount = 0,
-        .pPushConstantRanges = NULL,
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timeline_info,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &batch->command_buffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &uploader->timeline,
     };
-    vk_checked(vkCreatePipelineLayout(context->logical_device, &pipeline_layout_create_info, NULL,
-                                      &pipeline_layout));
+    vk_checked(vkQueueSubmit(uploader->queue, 1, &submit_info, VK_NULL_HANDLE));
 
-    VkGraphicsPipelineCreateInfo pipeline_create_info = {
-        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        .stageCount = 2,
-        .pStages = shader_stage_create_infos,
-        .pVertexInputState = &vertex_input_info,
-        .pInputAssemblyState = &input_assembly_info,
-        .pViewportState = &viewport_state,
-        .pRasterizationState = &rasterizer_create_info,
-        .pMultisampleState = &multi_sampling,
-        .pDepthStencilState = NULL,
-        .pColorBlendState = &color_blend_state,
-        .pDynamicState = NULL, // is this required?  I'm trying to opt out of dynamic state here
-        .layout = pipeline_layout,
-        .renderPass = context->render_pass,
-        .subpass = 0,
-        // so we can use these to set up another pipeline that is derived from this one
-        .basePipelineHandle = VK_NULL_HANDLE,
-        .basePipelineIndex = -1,
-    };
+    // hand the released buffers over to the graphics side, which needs to wait for this batch:
+    if (uploader->releases_count > 0)
+    {
+        for (uint32_t i = 0; i < uploader->releases_count; i++)
+        {
+            VkBufferMemoryBarrier acquire = uploader->releases[i];
+            acquire.srcAccessMask = 0;
+            acquire.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                    VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+            uploader->acquires[uploader->acquires_count++] = acquire;
+        }
+        uploader->releases_count = 0;
+        uploader->acquire_value = batch->value;
+    }
 
-    VkPipeline pipeline;
-    vk_checked(vkCreateGraphicsPipelines(context->logical_device, VK_NULL_HANDLE, 1,
-                                         &pipeline_create_info, NULL, &pipeline));
+    batch->ring_end = uploader->head;
+    batch->pending = true;
+    uploader->current = (uploader->current + 1) % UPLOAD_BATCHES;
+    uploader->recording = false;
+}
 
-    context->pipeline = pipeline;
+// Returns the timeline value the next graphics submission has to wait on before using uploaded
+// data, or 0 if there's nothing to wait for.
+uint64_t vk_upload_pending_acquire(vk_context *context)
+{
+    return context->uploader.acquires_count > 0 ? context->uploader.acquire_value : 0;
+}
 
-    // Because after the graphics pipeline has finished being created all this will have been
-    // compiled to machine code, we can safely free / de-init all our shader code & modules
-    // at the end of pipeline creation:
-    vkDestroyShaderModule(context->logical_device, vert_mod, NULL);
-    vkDestroyShaderModule(context->logical_device, frag_mod, NULL);
-    free(vert_shader.code);
-    free(frag_shader.code);
+// Records the acquire half of the ownership transfer for everything released by flushed batches.
+// Has to go into a graphics command buffer whose submission waits on vk_upload_pending_acquire's
+// value (at UPLOAD_CONSUMER_STAGES).  Later submissions are ordered after the barrier, so only the
+// first frame after an upload has to wait.
+void vk_upload_acquire(vk_context *context, VkCommandBuffer command_buffer)
+{
+    vk_uploader *uploader = &context->uploader;
+    if (uploader->acquires_count == 0)
+    {
+        return;
+    }
 
-    dbg("successfully enabled graphics pipeline\n");
+    vkCmdPipelineBarrier(command_buffer, UPLOAD_CONSUMER_STAGES, UPLOAD_CONSUMER_STAGES, 0, 0,
+                         NULL, uploader->acquires_count, uploader->acquires, 0, NULL);
+    uploader->acquires_count = 0;
 }
 
-void vk_init_render_pass(vk_context *context)
+// Returns the command buffer of the batch currently being recorded, starting a new one if needed.
+static VkCommandBuffer vk_upload_command_buffer(vk_context *context)
 {
-    // Create an attachment for our color buffer:
-    VkAttachmentDescription color_attachment = {
-        .format = context->swapchain_image_format,
-        // update for multi-sampling
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        // clear the data in the attachment before and after rendering
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        // keep the rendered contents in memory so we can read them later
-        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-        // we are not doing anything with the stencil buffer:
-        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        // images to be presented in the swap chain:
-        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-    };
-
-    VkAttachmentReference color_attachment_ref = {
-        .attachment = 0, // this is the index referenced by the `layout(location)` in the shaders
-        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-    };
+    vk_uploader *uploader = &context->uploader;
+    vk_upload_batch *batch = &uploader->batches[uploader->current];
+    if (uploader->recording)
+    {
+        return batch->command_buffer;
+    }
 
-    VkSubpassDescription subpass = {
-        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-        .colorAttachmentCount = 1,
-        .pColorAttachments = &color_attachment_ref,
-    };
+    // the batch we're about to reuse may still be in flight, and since it's the oldest one
+    // retiring it frees its space in the ring too:
+    while (batch->pending)
+    {
+        vk_upload_retire(context, true);
+    }
 
-    // Ensure that the render pass waits for the color attachment output bit stage:
-    VkSubpassDependency dependency = {
-        .srcSubpass = VK_SUBPASS_EXTERNAL, // implicit subpass before render
-        .dstSubpass = 0,
-        .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        .srcAccessMask = 0,
-        .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
+    vk_checked(vkResetCommandBuffer(batch->command_buffer, 0));
+    vk_checked(vkBeginCommandBuffer(batch->command_buffer, &begin_info));
+    uploader->recording = true;
+    return batch->command_buffer;
+}
 
-    VkRenderPass render_pass;
-    VkRenderPassCreateInfo render_pass_info = {.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-                                               .attachmentCount = 1,
-                                               .pAttachments = &color_attachment,
-                                               .subpassCount = 1,
-                                               .pSubpasses = &subpass,
-                                               .dependencyCount = 1,
-                                               .pDependencies = &dependency};
+// Reserves `size` bytes of the staging ring, returning the offset into the staging buffer.  Blocks
+// until the GPU is done with old uploads if the ring is full.
+static VkDeviceSize vk_upload_reserve(vk_context *context, VkDeviceSize size)
+{
+    vk_uploader *uploader = &context->uploader;
+    // keep every reservation 16 byte aligned, which covers the copy alignment rules for any of
+    // our formats:
+    size = (size + 15) & ~15ull;
+    assert(size <= STAGING_RING_SIZE && "upload chunk bigger than the staging ring");
+
+    // reservations can't wrap around the end of the ring, so skip the leftover bytes at the end:
+    VkDeviceSize start = uploader->head;
+    if (start % STAGING_RING_SIZE + size > STAGING_RING_SIZE)
+    {
+        start += STAGING_RING_SIZE - start % STAGING_RING_SIZE;
+    }
 
-    vk_checked(vkCreateRenderPass(context->logical_device, &render_pass_info, NULL, &render_pass));
-    context->render_pass = render_pass;
+    vk_upload_retire(context, false);
+    while (start + size - uploader->tail > STAGING_RING_SIZE)
+    {
+        // everything still in the ring might be in the batch we're recording right now:
+        if (uploader->recording)
+        {
+            vk_upload_flush(context);
+        }
+        vk_upload_retire(context, true);
+    }
 
-    dbg("successfully initialized render pass\n");
+    uploader->head = start + size;
+    return start % STAGING_RING_SIZE;
 }
 
-void vk_init_frame_buffers(vk_context *context)
+// Copies `size` bytes of `data` into `dst` at `dst_offset` via the staging ring.  The copy happens
+// on the GPU once vk_upload_flush is called.
+void vk_upload_buffer(vk_context *context, VkBuffer dst, VkDeviceSize dst_offset, const void *data,
+                      VkDeviceSize size)
 {
-    assert(context->image_views_count > 0 && context->render_pass != VK_NULL_HANDLE &&
-           "expected context image views & render pass to be initialized before frame buffers");
-    VkFramebuffer *swapchain_frame_buffers =
-        calloc(context->image_views_count, sizeof(VkFramebuffer));
+    vk_uploader *uploader = &context->uploader;
+    // split big uploads up so that each chunk fits in the ring next to whatever's already there:
+    const VkDeviceSize max_chunk = STAGING_RING_SIZE / 4;
 
-    for (uint32_t i = 0; i < context->image_views_count; i++)
+    for (VkDeviceSize done = 0; done < size;)
     {
-        VkFramebufferCreateInfo create_info = {
-            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .renderPass = context->render_pass,
-            .attachmentCount = 1,
-            .pAttachments = &context->image_views[i],
-            .width = context->swapchain_extent.width,
-            .height = context->swapchain_extent.height,
-            .layers = 1,
+        VkDeviceSize chunk = size - done < max_chunk ? size - done : max_chunk;
+        VkDeviceSize staging_offset = vk_upload_reserve(context, chunk);
+        memcpy((char *)uploader->staging_allocation.mapped + staging_offset,
+               (const char *)data + done, chunk);
+
+        VkBufferCopy region = {
+            .srcOffset = staging_offset,
+            .dstOffset = dst_offset + done,
+            .size = chunk,
         };
+        vkCmdCopyBuffer(vk_upload_command_buffer(context), uploader->staging_buffer, dst, 1,
+                        &region);
+        done += chunk;
+    }
 
-        vk_checked(vkCreateFramebuffer(context->logical_device, &create_info, NULL,
-                                       &swapchain_frame_buffers[i]));
+    if (!vk_upload_needs_handoff(context))
+    {
+        return;
     }
 
-    context->framebuffer_count = context->image_views_count;
-    context->framebuffers = swapchain_frame_buffers;
+    // queue up the release half of the ownership transfer.  If the loop above flushed part way
+    // through that's still fine, since the barrier covers every earlier copy on the transfer queue.
+    if (uploader->releases_count + uploader->acquires_count == uploader->ownership_capacity)
+    {
+        uint32_t capacity = uploader->ownership_capacity ? uploader->ownership_capacity * 2 : 64;
+        uploader->releases = realloc(uploader->releases, capacity * sizeof(VkBufferMemoryBarrier));
+        uploader->acquires = realloc(uploader->acquires, capacity * sizeof(VkBufferMemoryBarrier));
+        assert(uploader->releases && uploader->acquires && "failed to grow ownership barriers");
+        uploader->ownership_capacity = capacity;
+    }
 
-    dbg("successfully initialized frame buffers\n");
+    uploader->releases[uploader->releases_count++] = (VkBufferMemoryBarrier){
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = 0,
+        .srcQueueFamilyIndex = uploader->queue_family,
+        .dstQueueFamilyIndex = context->queue_indices.graphics,
+        .buffer = dst,
+        .offset = dst_offset,
+        .size = size,
+    };
 }
 
-void vk_init_command_pool(vk_context *context)
+// Creates a device local buffer with `usage` and fills it with `data` through the staging ring.
+void vk_create_device_buffer(vk_context *context, const void *data, VkDeviceSize size,
+                             VkBufferUsageFlags usage, VkBuffer *buffer, vk_allocation *allocation)
 {
-    VkCommandPoolCreateInfo pool_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        // allow command buffers to be re-recorded individually
-        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-        .queueFamilyIndex = context->queue_indices.graphics,
-    };
+    vk_create_buffer(context, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, buffer, allocation);
+    vk_upload_buffer(context, *buffer, 0, data, size);
+}
 
-    VkCommandPool command_pool;
-    vk_checked(vkCreateCommandPool(context->logical_device, &pool_info, NULL, &command_pool));
+// Our one and only mesh for now:
+static const vertex triangle_vertices[] = {
+    {{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+    {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
+    {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+};
 
-    context->command_pool = command_pool;
-    dbg("successfully initialized command pool\n");
+static const uint16_t triangle_indices[] = {0, 1, 2};
+
+// distance from the origin to the triangle's furthest vertex, for culling:
+static const float triangle_radius = 0.7072f;
+
+void vk_init_mesh(vk_context *context)
+{
+    vk_create_device_buffer(context, triangle_vertices, sizeof(triangle_vertices),
+                            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &context->vertex_buffer,
+                            &context->vertex_allocation);
+    vk_create_device_buffer(context, triangle_indices, sizeof(triangle_indices),
+                            VK_BUFFER_USAGE_INDEX_BUFFER_BIT, &context->index_buffer,
+                            &context->index_allocation);
+    context->index_count = sizeof(triangle_indices) / sizeof(triangle_indices[0]);
+    vk_upload_flush(context);
+
+    dbg("successfully uploaded mesh (%d indices)\n", context->index_count);
 }
 
-void vk_init_command_buffers(vk_context *context)
+static VkSurfaceFormatKHR choose_swapchain_surface_format(vk_context *context)
 {
-    assert(context->command_pool != VK_NULL_HANDLE &&
-           "expected context->command_pool to be initialized before initializing command buffers");
+    vk_swapchain_support *support = context->swapchain_support;
+    // choose swap surface format:
+    bool found_format = false;
+    VkSurfaceFormatKHR chosen_format;
+    for (uint32_t i = 0; i < support->surface_formats_count; i++)
+    {
+        VkSurfaceFormatKHR iter_format = support->surface_formats[i];
+        if (iter_format.format == VK_FORMAT_B8G8R8A8_SRGB &&
+            iter_format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+        {
+            chosen_format = iter_format;
+            found_format = true;
+            break;
+        }
+    }
 
-    VkCommandBufferAllocateInfo buffer_alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = context->command_pool,
-        // can be submitted to a queue for execution, but cannot be called from other command
-        // buffers
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1,
-    };
+    // if we made it through the loop and we didn't find one, just pick the first one:
+    // remember that we are guaranteed to have at least one format
+    if (!found_format)
+    {
+        chosen_format = support->surface_formats[0];
+    }
+
+    return chosen_format;
+}
+
+static VkPresentModeKHR choose_presentation_mode(vk_context *context)
+{
+    vk_swapchain_support *support = context->swapchain_support;
+    bool found_format = false;
+    VkPresentModeKHR chosen_mode;
+
+    for (uint32_t i = 0; i < support->present_modes_count; i++)
+    {
+        VkPresentModeKHR available = support->present_modes[i];
+        if (available == VK_PRESENT_MODE_MAILBOX_KHR)
+        {
+            dbg("chose presentation mode: VK_PRESENT_MODE_MAILBOX_KHR\n");
+            found_format = true;
+            chosen_mode = available;
+        }
+    }
+
+    // only VK_PRESENT_MODE_FIFO_KHR is guaranteed to be available, but we will try to select
+    // VK_PRESENT_MODE_MAILFIX_KHR if we can
+    if (!found_format)
+    {
+        dbg("chose presentation mode: VK_PRESENT_MODE_FIFO_KHR\n");
+        chosen_mode = VK_PRESENT_MODE_FIFO_KHR;
+    }
+
+    return chosen_mode;
+}
+
+uint32_t clamp(uint32_t value, uint32_t lb, uint32_t ub)
+{
+    // cmp w0, w1
+    // csel w8, w0, w1, HI
+    // etc
+    uint32_t t = value < lb ? lb : value;
+    return t > ub ? ub : value;
+}
+
+VkExtent2D choose_swap_extent(vk_context *context)
+{
+    VkSurfaceCapabilitiesKHR *capabilities = context->swapchain_support->surface_capabilities;
+    // If the window manager allows us to not specify the current extent as the resolution of the
+    // window, then it will set currentExtent to UINT32_MAX, and then it's on us to set the width
+    // and height in pixels based on the minimum and maximum image extent
+    if (capabilities->currentExtent.width != UINT32_MAX)
+    {
+        return capabilities->currentExtent;
+    }
+
+    int width, height;
+    SDL_Vulkan_GetDrawableSize(context->window, &width, &height);
+
+    VkExtent2D extent = {
+        .width = (uint32_t)width,
+        .height = (uint32_t)height,
+    };
+
+    extent.width =
+        clamp(extent.width, capabilities->minImageExtent.width, capabilities->maxImageExtent.width);
+    extent.height = clamp(extent.height, capabilities->minImageExtent.height,
+                          capabilities->maxImageExtent.height);
+
+    return extent;
+}
+
+void vk_init_swap_chain(vk_context *context)
+{
+    assert(context->swapchain_support &&
+           "context->swapchain_support must be initialized before initing swap chain");
+    VkSurfaceFormatKHR surface_format = choose_swapchain_surface_format(context);
+    VkPresentModeKHR present_mode = choose_presentation_mode(context);
+    VkExtent2D extent = choose_swap_extent(context);
+
+    VkSurfaceCapabilitiesKHR *capabilities = context->swapchain_support->surface_capabilities;
+    // choose how many images we want to have in the swap chain (1 more than the minimum):
+    uint32_t image_count = capabilities->minImageCount + 1;
+
+    // make sure we are not exceeding the maximum (where 0 means there is no maximum)
+    if (capabilities->maxImageCount > 0 && image_count > capabilities->maxImageCount)
+    {
+        image_count = capabilities->maxImageCount;
+    }
+    dbg("creating swapchain with %d min images\n", image_count);
+
+    VkSwapchainCreateInfoKHR create_info = {
+        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+        .surface = context->surface,
+        .minImageCount = image_count,
+        .imageFormat = surface_format.format,
+        .imageColorSpace = surface_format.colorSpace,
+        .imageExtent = extent,
+        .imageArrayLayers = 1,
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        // No pre-transformation of images:
+        .preTransform = capabilities->currentTransform,
+        // the alpha channel used for blending with other windows (ignored here):
+        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+        .presentMode = present_mode,
+        // we don't care about the color of pixels that are obscured:
+        .clipped = VK_TRUE,
+        // when re-creating, hand over the swapchain we're replacing so the driver can reuse its
+        // resources (VK_NULL_HANDLE the first time around)
+        .oldSwapchain = context->swapchain,
+    };
+
+    // set up queue sharing modes:
+    uint32_t queue_family_indices[] = {context->queue_indices.graphics,
+                                       context->queue_indices.presentation};
+
+    if (context->queue_indices.graphics != context->queue_indices.presentation)
+    {
+        create_info.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+        create_info.queueFamilyIndexCount = 2;
+        create_info.pQueueFamilyIndices = queue_family_indices;
+    }
+    else
+    {
+        create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        create_info.queueFamilyIndexCount = 0;
+        create_info.pQueueFamilyIndices = NULL;
+    }
+
+    VkSwapchainKHR swapchain;
+    vk_checked(vkCreateSwapchainKHR(context->logical_device, &create_info, NULL, &swapchain));
+    context->swapchain = swapchain;
+
+    dbg("sucessfully created swapchain \n");
+
+    // get handles to the swap chain images:
+    uint32_t actual_image_count;
+    vkGetSwapchainImagesKHR(context->logical_device, context->swapchain, &actual_image_count, NULL);
+
+    VkImage *images = calloc(actual_image_count, sizeof(VkImage));
+    vkGetSwapchainImagesKHR(context->logical_device, context->swapchain, &actual_image_count,
+                            images);
+
+    context->swapchain_images = images;
+    context->swapchain_image_count = actual_image_count;
+    context->swapchain_image_format = surface_format.format;
+    context->swapchain_extent = extent;
+
+    dbg("retrieved swapchain image handles with count = %d\n", actual_image_count);
+}
+
+// Headless replacement for vk_init_swap_chain: creates device local images to render into (which
+// get stored in context->swapchain_images so that the image view / framebuffer code doesn't need to
+// care), plus a host visible buffer per image that we copy each finished frame into.
+void vk_init_offscreen_targets(vk_context *context, uint32_t width, uint32_t height)
+{
+    assert(context->headless && "offscreen targets are only used in headless mode");
+    assert(context->logical_device != VK_NULL_HANDLE &&
+           "context->logical_device must be initialized before creating offscreen targets");
+
+    // one image per frame in flight is enough since we never have to wait on a presentation
+    // engine to give images back to us:
+    uint32_t image_count = MAX_FRAMES_IN_FLIGHT;
+    // sRGB so that the bytes we read back are the same ones that would have been presented by the
+    // B8G8R8A8_SRGB swapchain in windowed mode (just in RGBA order, which is what PPM wants):
+    VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+    VkDeviceSize readback_size = (VkDeviceSize)width * height * 4;
+
+    context->swapchain_images = calloc(image_count, sizeof(VkImage));
+    context->offscreen_allocations = calloc(image_count, sizeof(vk_allocation));
+    context->readback_buffers = calloc(image_count, sizeof(VkBuffer));
+    context->readback_allocations = calloc(image_count, sizeof(vk_allocation));
+    context->readback_pending = calloc(image_count, sizeof(uint64_t));
+
+    for (uint32_t i = 0; i < image_count; i++)
+    {
+        VkImageCreateInfo image_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = format,
+            .extent = {.width = width, .height = height, .depth = 1},
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            // we render to it and then copy out of it:
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+        vk_create_image(context, &image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+                        &context->swapchain_images[i], &context->offscreen_allocations[i]);
+
+        // (the allocator keeps host visible memory mapped for us)
+        vk_create_buffer(context, readback_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         VK_MEMORY_PROPERTY_HOST_CACHED_BIT, &context->readback_buffers[i],
+                         &context->readback_allocations[i]);
+
+        context->readback_pending[i] = UINT64_MAX;
+    }
+
+    context->swapchain_image_count = image_count;
+    context->swapchain_image_format = format;
+    context->swapchain_extent = (VkExtent2D){.width = width, .height = height};
+
+    dbg("successfully created %d offscreen targets (%dx%d)\n", image_count, width, height);
+}
+
+// Hands the frame waiting in offscreen image `image_index` (if there is one) to the readback
+// callback.  The caller has to make sure the GPU is done with the frame first.
+static void vk_collect_readback(vk_context *context, uint32_t image_index)
+{
+    uint64_t frame_number = context->readback_pending[image_index];
+    if (frame_number == UINT64_MAX)
+    {
+        return;
+    }
+
+    if (context->readback_callback != NULL)
+    {
+        context->readback_callback(context->readback_allocations[image_index].mapped,
+                                   context->swapchain_extent.width,
+                                   context->swapchain_extent.height, frame_number,
+                                   context->readback_user_data);
+    }
+    context->readback_pending[image_index] = UINT64_MAX;
+}
+
+void vk_init_image_views(vk_context *context)
+{
+    VkImageView *image_views = calloc(context->swapchain_image_count, sizeof(VkImageView));
+    for (uint32_t i = 0; i < context->swapchain_image_count; i++)
+    {
+        VkImageViewCreateInfo create_info = {.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                                             .image = context->swapchain_images[i],
+                                             .viewType = VK_IMAGE_VIEW_TYPE_2D,
+                                             .format = context->swapchain_image_format,
+                                             .components =
+                                                 (VkComponentMapping){
+                                                     .r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                                                     .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                                                     .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                                                     .a = VK_COMPONENT_SWIZZLE_IDENTITY,
+                                                 },
+                                             .subresourceRange =
+                                                 (VkImageSubresourceRange){
+                                                     .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                                     .baseMipLevel = 0,
+                                                     .levelCount = 1,
+                                                     .baseArrayLayer = 0,
+                                                     .layerCount = 1,
+                                                 }
+
+        };
+
+        vk_checked(vkCreateImageView(context->logical_device, &create_info, NULL, &image_views[i]));
+    }
+
+    context->image_views_count = context->swapchain_image_count;
+    context->image_views = image_views;
+    dbg("successfully initialized image views\n");
+}
+
+#define SPIRV_MAGIC 0x07230203u
+
+// SPIR-V bytecode mapped straight from disk.  mmap() hands back page aligned memory, so the words
+// can go to vkCreateShaderModule as they are, without copying them into a buffer first.
+typedef struct shader_code
+{
+    const uint32_t *words;
+    // in bytes, like VkShaderModuleCreateInfo::codeSize
+    size_t size;
+    const char *entry_point;
+    // true if this is its own mapping (a loose file) rather than a piece of the shader archive
+    bool mapped;
+} shader_code;
+
+shader_code map_shader_code(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        dbg("could not read shader file at path %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        dbg("could not stat shader file at path %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    // A module is at least the 5 word header, and always a whole number of words.  Checking this
+    // before mapping also means we never try to mmap() an empty file, which fails.
+    size_t size = (size_t)st.st_size;
+    if (size < 5 * sizeof(uint32_t) || size % sizeof(uint32_t) != 0)
+    {
+        dbg("%s is not SPIR-V: size %lu is not a whole number of words (or too small)\n", path,
+            size);
+        exit(1);
+    }
+
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file alive on its own, so the descriptor isn't needed anymore:
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        dbg("could not mmap shader file at path %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    shader_code result = {.words = mapping, .size = size, .entry_point = "main", .mapped = true};
+    if (result.words[0] != SPIRV_MAGIC)
+    {
+        // SPIR-V may technically be either endianness, but Vulkan only takes host order:
+        if (result.words[0] == __builtin_bswap32(SPIRV_MAGIC))
+        {
+            dbg("%s is SPIR-V with the wrong endianness\n", path);
+        }
+        else
+        {
+            dbg("%s is not SPIR-V: bad magic number 0x%08x\n", path, result.words[0]);
+        }
+        exit(1);
+    }
+
+    dbg("mapped %lu bytes of shader bytecode from %s\n", result.size, path);
+    return result;
+}
+
+void release_shader_code(shader_code *code)
+{
+    if (code->mapped)
+    {
+        munmap((void *)code->words, code->size);
+    }
+    code->words = NULL;
+    code->size = 0;
+}
+
+// Shaders normally come out of the archive that the Makefile packs with tools/pack_shaders (see
+// shader_pack.h): one file, opened and mapped once at startup, with modules handed to
+// vkCreateShaderModule straight out of the mapping.  If there's no archive we fall back to the
+// loose .spv files, which is also what hot reloading uses since that's what it recompiles.
+#ifndef SHADER_ARCHIVE_PATH
+#define SHADER_ARCHIVE_PATH "build/shaders.pak"
+#endif
+
+typedef struct shader_archive
+{
+    const uint8_t *data;
+    size_t size;
+    const shader_pack_entry *entries;
+    uint32_t entry_count;
+} shader_archive;
+
+// Checks every entry up front, so lookups can trust the index:
+static bool shader_archive_valid(const uint8_t *data, size_t size)
+{
+    shader_pack_header header;
+    if (size < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != SHADER_PACK_MAGIC || header.version != SHADER_PACK_VERSION ||
+        header.entry_count > (size - sizeof(header)) / sizeof(shader_pack_entry))
+    {
+        return false;
+    }
+
+    const shader_pack_entry *entries = (const shader_pack_entry *)(data + sizeof(header));
+    for (uint32_t i = 0; i < header.entry_count; i++)
+    {
+        const shader_pack_entry *entry = &entries[i];
+        if (memchr(entry->name, '\0', sizeof(entry->name)) == NULL ||
+            memchr(entry->entry_point, '\0', sizeof(entry->entry_point)) == NULL ||
+            entry->offset % sizeof(uint32_t) != 0 || entry->size % sizeof(uint32_t) != 0 ||
+            entry->size < 5 * sizeof(uint32_t) || entry->offset > size ||
+            entry->size > size - entry->offset)
+        {
+            return false;
+        }
+
+        uint32_t magic;
+        memcpy(&magic, data + entry->offset, sizeof(magic));
+        if (magic != SPIRV_MAGIC)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void vk_open_shader_archive(vk_context *context)
+{
+#ifdef SHADER_HOT_RELOAD
+    dbg("shader hot reloading is on, loading loose shader files instead of %s\n",
+        SHADER_ARCHIVE_PATH);
+    return;
+#endif
+
+    int fd = open(SHADER_ARCHIVE_PATH, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        dbg("no shader archive at %s (%s), loading loose shader files\n", SHADER_ARCHIVE_PATH,
+            strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        dbg("could not mmap shader archive %s: %s\n", SHADER_ARCHIVE_PATH, strerror(errno));
+        exit(1);
+    }
+
+    if (!shader_archive_valid(mapping, st.st_size))
+    {
+        dbg("%s is not a valid shader archive, try rebuilding it\n", SHADER_ARCHIVE_PATH);
+        exit(1);
+    }
+
+    shader_archive *archive = malloc(sizeof(shader_archive));
+    archive->data = mapping;
+    archive->size = st.st_size;
+    archive->entries = (const shader_pack_entry *)(archive->data + sizeof(shader_pack_header));
+    memcpy(&archive->entry_count, archive->data + offsetof(shader_pack_header, entry_count),
+           sizeof(uint32_t));
+    context->shaders = archive;
+    dbg("mapped shader archive %s: %u modules, %lu bytes\n", SHADER_ARCHIVE_PATH,
+        archive->entry_count, archive->size);
+}
+
+// Unmaps the archive again.  Only once no more pipelines can get built, since modules come
+// straight out of the mapping.
+void vk_close_shader_archive(vk_context *context)
+{
+    if (context->shaders == NULL)
+    {
+        return;
+    }
+
+    munmap((void *)context->shaders->data, context->shaders->size);
+    free(context->shaders);
+    context->shaders = NULL;
+}
+
+// Looks up a shader by its source name (e.g. "shader.vert"), from the archive if we have one and
+// from shaders/<name>.spv otherwise.  Release it with release_shader_code once the module exists.
+shader_code vk_load_shader(vk_context *context, const char *name, VkShaderStageFlagBits stage)
+{
+    if (context->shaders == NULL)
+    {
+        char path[4096];
+        snprintf(path, sizeof(path), "shaders/%s.spv", name);
+        return map_shader_code(path);
+    }
+
+    shader_archive *archive = context->shaders;
+    for (uint32_t i = 0; i < archive->entry_count; i++)
+    {
+        const shader_pack_entry *entry = &archive->entries[i];
+        if (strcmp(entry->name, name) != 0)
+        {
+            continue;
+        }
+
+        if (entry->stage != (uint32_t)stage)
+        {
+            dbg("shader %s in %s has stage 0x%x, expected 0x%x\n", name, SHADER_ARCHIVE_PATH,
+                entry->stage, stage);
+            exit(1);
+        }
+
+        // the index was checked when we mapped the archive, but the module bytes weren't, so make
+        // sure they're still what the packer hashed before handing them to the driver:
+        if (shader_pack_hash(archive->data + entry->offset, entry->size) != entry->hash)
+        {
+            dbg("shader %s in %s is corrupt (hash mismatch), try rebuilding it\n", name,
+                SHADER_ARCHIVE_PATH);
+            exit(1);
+        }
+
+        return (shader_code){
+            .words = (const uint32_t *)(archive->data + entry->offset),
+            .size = entry->size,
+            .entry_point = entry->entry_point,
+            .mapped = false,
+        };
+    }
+
+    dbg("shader %s is not in %s, try rebuilding it\n", name, SHADER_ARCHIVE_PATH);
+    exit(1);
+}
+
+VkShaderModule create_shader_module(vk_context *context, const shader_code *code)
+{
+    VkShaderModule mod;
+    VkShaderModuleCreateInfo create_info = {.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+                                            .codeSize = code->size,
+                                            .pCode = code->words};
+    vk_checked(vkCreateShaderModule(context->logical_device, &create_info, NULL, &mod));
+
+    return mod;
+}
+
+// Checks that pipeline cache data read from disk was written by the same driver + device we are
+// running on now.  Drivers are supposed to reject mismatched data themselves, but not all of them
+// do it gracefully, and it's cheap to check.
+static bool pipeline_cache_header_valid(vk_context *context, const void *data, size_t size)
+{
+    VkPipelineCacheHeaderVersionOne header;
+    if (size < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    VkPhysicalDeviceProperties *props = &context->physical_device_props;
+    return header.headerSize >= sizeof(header) && header.headerSize <= size &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == props->vendorID && header.deviceID == props->deviceID &&
+           memcmp(header.pipelineCacheUUID, props->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+// Creates the pipeline cache, seeded with whatever the last run saved to PIPELINE_CACHE_PATH (if it
+// exists and matches this device) so that we don't have to compile our shaders from scratch on
+// every launch.
+void vk_init_pipeline_cache(vk_context *context)
+{
+    assert(context->logical_device != VK_NULL_HANDLE &&
+           "context->logical_device must be initialized before creating the pipeline cache");
+
+    void *data = NULL;
+    size_t size = 0;
+
+    FILE *file = fopen(PIPELINE_CACHE_PATH, "rb");
+    if (file != NULL)
+    {
+        fseek(file, 0, SEEK_END);
+        long file_size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        if (file_size > 0)
+        {
+            data = malloc(file_size);
+            size = fread(data, 1, file_size, file);
+        }
+        fclose(file);
+
+        if (!pipeline_cache_header_valid(context, data, size))
+        {
+            dbg("ignoring stale or invalid pipeline cache at %s\n", PIPELINE_CACHE_PATH);
+            free(data);
+            data = NULL;
+            size = 0;
+        }
+    }
+
+    VkPipelineCacheCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = size,
+        .pInitialData = data,
+    };
+    vk_checked(vkCreatePipelineCache(context->logical_device, &create_info, NULL,
+                                     &context->pipeline_cache));
+    free(data);
+
+    dbg("successfully initialized pipeline cache (%lu bytes loaded)\n", size);
+}
+
+// Writes the pipeline cache back to PIPELINE_CACHE_PATH.  We write to a temporary file and rename
+// it over the old one so that a crash halfway through can never leave a truncated cache behind,
+// then fsync the directory so the rename survives a crash as well.
+void vk_save_pipeline_cache(vk_context *context)
+{
+    size_t size;
+    vk_checked(
+        vkGetPipelineCacheData(context->logical_device, context->pipeline_cache, &size, NULL));
+    void *data = malloc(size);
+    vk_checked(
+        vkGetPipelineCacheData(context->logical_device, context->pipeline_cache, &size, data));
+
+    const char *tmp_path = PIPELINE_CACHE_PATH ".tmp";
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL)
+    {
+        dbg("could not open %s for writing: %s\n", tmp_path, strerror(errno));
+        free(data);
+        return;
+    }
+
+    bool ok = fwrite(data, 1, size, file) == size;
+    ok = fflush(file) == 0 && ok;
+    ok = fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+    free(data);
+
+    // a missing cache only costs us startup time, so this isn't fatal:
+    if (!ok || rename(tmp_path, PIPELINE_CACHE_PATH) != 0)
+    {
+        dbg("could not save pipeline cache to %s: %s\n", PIPELINE_CACHE_PATH, strerror(errno));
+        remove(tmp_path);
+        return;
+    }
+
+    // the rename is only durable once the directory is synced too (PIPELINE_CACHE_PATH is
+    // relative, so that's the working directory):
+    int dir = open(".", O_RDONLY | O_DIRECTORY);
+    if (dir < 0 || fsync(dir) != 0)
+    {
+        dbg("could not sync the directory of %s: %s\n", PIPELINE_CACHE_PATH, strerror(errno));
+    }
+    if (dir >= 0)
+    {
+        close(dir);
+    }
+
+    dbg("saved %lu bytes of pipeline cache to %s\n", size, PIPELINE_CACHE_PATH);
+}
+
+// Creates one graphics pipeline from `info` with our depth state filled in.  With --depth-prepass
+// every pipeline comes in two: the `prepass` one only writes depth (no fragment shader, no color
+// writes), and the normal one then only shades fragments whose depth is EQUAL to what the prepass
+// left, so every pixel gets shaded once no matter how much overdraw there is.
+static VkPipeline vk_create_graphics_pipeline(vk_context *context,
+                                              VkGraphicsPipelineCreateInfo info, bool prepass)
+{
+    // reverse-Z: the near plane is 1 and the far plane 0, so nearer = GREATER.  Floats have most of
+    // their precision near 0, which this spreads over the whole depth range instead of wasting it
+    // right in front of the camera.
+    VkPipelineDepthStencilStateCreateInfo depth_stencil = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+        .depthTestEnable = VK_TRUE,
+        .depthWriteEnable = prepass || !context->depth_prepass,
+        .depthCompareOp =
+            context->depth_prepass && !prepass ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_GREATER,
+        .depthBoundsTestEnable = VK_FALSE,
+        .stencilTestEnable = VK_FALSE,
+    };
+    info.pDepthStencilState = &depth_stencil;
+
+    VkPipelineColorBlendAttachmentState blend_attachment = info.pColorBlendState->pAttachments[0];
+    VkPipelineColorBlendStateCreateInfo blend_state = *info.pColorBlendState;
+    if (prepass)
+    {
+        // (the vertex shader is always stage 0)
+        info.stageCount = 1;
+        blend_attachment.colorWriteMask = 0;
+    }
+    blend_state.pAttachments = &blend_attachment;
+    info.pColorBlendState = &blend_state;
+
+    VkPipeline pipeline;
+    vk_checked(vkCreateGraphicsPipelines(context->logical_device, context->pipeline_cache, 1, &info,
+                                         NULL, &pipeline));
+    return pipeline;
+}
+
+// Creates the graphics pipeline (and the --instances / --depth-prepass versions of it, if we need
+// them) from the shaders on disk, specialized for `features` (pipeline_feature bits).  Only reads
+// from the context, so that the shader hot reloader can build new pipelines in the background
+// while the current ones are still in use.
+static void vk_create_graphics_pipelines(vk_context *context, uint32_t features,
+                                         vk_pipeline_variant *out)
+{
+    shader_specialization specialization = {
+        .debug_objects = (features & PIPELINE_FEATURE_DEBUG_OBJECTS) != 0,
+        .encode_srgb = (features & PIPELINE_FEATURE_ENCODE_SRGB) != 0,
+    };
+    VkSpecializationMapEntry specialization_entries[] = {
+        {
+            .constantID = 0,
+            .offset = offsetof(shader_specialization, debug_objects),
+            .size = sizeof(VkBool32),
+        },
+        {
+            .constantID = 1,
+            .offset = offsetof(shader_specialization, encode_srgb),
+            .size = sizeof(VkBool32),
+        },
+    };
+    VkSpecializationInfo specialization_info = {
+        .mapEntryCount = sizeof(specialization_entries) / sizeof(specialization_entries[0]),
+        .pMapEntries = specialization_entries,
+        .dataSize = sizeof(specialization),
+        .pData = &specialization,
+    };
+
+    // load our shaders:
+    shader_code vert_shader = vk_load_shader(context, "shader.vert", VK_SHADER_STAGE_VERTEX_BIT);
+    shader_code frag_shader = vk_load_shader(context, "shader.frag", VK_SHADER_STAGE_FRAGMENT_BIT);
+
+    // create shader modules:
+    VkShaderModule vert_mod = create_shader_module(context, &vert_shader);
+    VkShaderModule frag_mod = create_shader_module(context, &frag_shader);
+
+    // create shader stages:
+    VkPipelineShaderStageCreateInfo vertex_shader_stage_create = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_VERTEX_BIT,
+        .module = vert_mod,
+        .pName = vert_shader.entry_point,
+        .pSpecializationInfo = &specialization_info,
+    };
+
+    VkPipelineShaderStageCreateInfo frag_shader_stage_create = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .module = frag_mod,
+        .pName = frag_shader.entry_point,
+        .pSpecializationInfo = &specialization_info,
+    };
+
+    VkPipelineShaderStageCreateInfo shader_stage_create_infos[] = {vertex_shader_stage_create,
+                                                                   frag_shader_stage_create};
+
+    // configure fixed-function operations:
+
+    // describe the format of the vertex data passed to vertex shader: one interleaved buffer of
+    // `vertex` structs
+    VkVertexInputBindingDescription vertex_binding = {
+        .binding = 0,
+        .stride = sizeof(vertex),
+        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+    };
+
+    VkVertexInputAttributeDescription vertex_attributes[] = {
+        {
+            .location = 0, // inPosition
+            .binding = 0,
+            .format = VK_FORMAT_R32G32_SFLOAT,
+            .offset = offsetof(vertex, pos),
+        },
+        {
+            .location = 1, // inColor
+            .binding = 0,
+            .format = VK_FORMAT_R32G32B32_SFLOAT,
+            .offset = offsetof(vertex, color),
+        },
+    };
+
+    VkPipelineVertexInputStateCreateInfo vertex_input_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 1,
+        .pVertexBindingDescriptions = &vertex_binding,
+        .vertexAttributeDescriptionCount = 2,
+        .pVertexAttributeDescriptions = vertex_attributes,
+    };
+
+    // describe the kind of geometry drawn from the vertices and if primitive restart should be
+    // enabled
+    VkPipelineInputAssemblyStateCreateInfo input_assembly_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        .primitiveRestartEnable = VK_FALSE, // not required for non-strip topologies
+    };
+
+    // Viewport and scissor are dynamic and get set in vk_record_command_buffer, so that the
+    // pipeline doesn't have to be rebuilt when the window is resized:
+    VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamic_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = 2,
+        .pDynamicStates = dynamic_states,
+    };
+
+    // (only the counts matter when the state is dynamic)
+    VkPipelineViewportStateCreateInfo viewport_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .pViewports = NULL,
+        .scissorCount = 1,
+        .pScissors = NULL,
+    };
+
+    VkPipelineRasterizationStateCreateInfo rasterizer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        // VK_TRUE = fragments beyond the near and far plans are clamped to them instead of
+        // discarding them (GPU feature required).
+        .depthClampEnable = VK_FALSE,
+        // VK_TRUE = geometry never passes through the rasterizer stage, disabling all output to
+        // the framebuffer
+        .rasterizerDiscardEnable = VK_FALSE,
+        // determines how fragments are generated for geometry (fill, line, or point)
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .lineWidth = 1.0f,
+        .cullMode = VK_CULL_MODE_BACK_BIT,
+        .frontFace = VK_FRONT_FACE_CLOCKWISE,
+        .depthBiasEnable = VK_FALSE,
+        // Sometimes adjusted for shadow mapping:
+        .depthBiasConstantFactor = 0.0f,
+        .depthBiasClamp = 0.0f,
+        .depthBiasSlopeFactor = 0.0f,
+    };
+
+    // the sample count is whatever choose_sample_count settled on for --msaa (1 without it), and
+    // has to match the attachments we render to:
+    VkPipelineMultisampleStateCreateInfo multi_sampling = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .sampleShadingEnable = VK_FALSE,
+        .rasterizationSamples = context->msaa_samples,
+        .minSampleShading = 1.0f,
+        .pSampleMask = NULL,
+        .alphaToCoverageEnable = VK_FALSE,
+        .alphaToOneEnable = VK_FALSE,
+    };
+
+    // (depth state is filled in by vk_create_graphics_pipeline)
+
+    // color blending: turn off both modes so that fragment colors are passed through to the final
+    // image unmodified
+    // configure color blending for our 1 framebuffer:
+    VkPipelineColorBlendAttachmentState color_blend_attachment = {
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+        .blendEnable = false,
+        .srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
+        .colorBlendOp = VK_BLEND_OP_ADD,
+        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+        .alphaBlendOp = VK_BLEND_OP_ADD,
+    };
+
+    // set constants to be used in the operations described by the blend attachment:
+    VkPipelineColorBlendStateCreateInfo color_blend_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .logicOpEnable = VK_FALSE,
+        .logicOp = VK_LOGIC_OP_COPY,
+        .attachmentCount = 1,
+        .pAttachments = &color_blend_attachment,
+        .blendConstants = {0.0f, 0.0f, 0.0f, 0.0f},
+    };
+
+    // with dynamic rendering there's no render pass to be compatible with, so the pipeline just
+    // gets told the attachment formats instead:
+    VkPipelineRenderingCreateInfo rendering_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+        .colorAttachmentCount = 1,
+        .pColorAttachmentFormats = &context->swapchain_image_format,
+        .depthAttachmentFormat = context->depth_format,
+    };
+
+    // create the pipeline
+    VkGraphicsPipelineCreateInfo pipeline_create_info = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .pNext = context->dynamic_rendering ? &rendering_create_info : NULL,
+        .stageCount = 2,
+        .pStages = shader_stage_create_infos,
+        .pVertexInputState = &vertex_input_info,
+        .pInputAssemblyState = &input_assembly_info,
+        .pViewportState = &viewport_state,
+        .pRasterizationState = &rasterizer_create_info,
+        .pMultisampleState = &multi_sampling,
+        .pColorBlendState = &color_blend_state,
+        .pDynamicState = &dynamic_state,
+        .layout = context->pipeline_layout,
+        .renderPass = context->render_pass,
+        .subpass = 0,
+        // so we can use these to set up another pipeline that is derived from this one
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1,
+    };
+
+    out->pipeline = vk_create_graphics_pipeline(context, pipeline_create_info, false);
+    if (context->depth_prepass)
+    {
+        out->prepass_pipeline = vk_create_graphics_pipeline(context, pipeline_create_info, true);
+    }
+
+    // --instances uses the same pipeline, just with a different vertex shader and a second,
+    // per-instance vertex buffer:
+    if (context->instance_count > 0)
+    {
+        shader_code instanced_shader =
+            vk_load_shader(context, "instanced.vert", VK_SHADER_STAGE_VERTEX_BIT);
+        VkShaderModule instanced_mod = create_shader_module(context, &instanced_shader);
+        shader_stage_create_infos[0].module = instanced_mod;
+        shader_stage_create_infos[0].pName = instanced_shader.entry_point;
+
+        VkVertexInputBindingDescription instanced_bindings[] = {
+            vertex_binding,
+            {
+                .binding = 1,
+                .stride = sizeof(instance_data),
+                // advance once per instance instead of once per vertex
+                .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE,
+            },
+        };
+        VkVertexInputAttributeDescription instanced_attributes[] = {
+            vertex_attributes[0],
+            vertex_attributes[1],
+            {
+                .location = 2, // inTransform
+                .binding = 1,
+                .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+                .offset = offsetof(instance_data, transform),
+            },
+            {
+                .location = 3, // inTint
+                .binding = 1,
+                .format = VK_FORMAT_R8G8B8A8_UNORM,
+                .offset = offsetof(instance_data, color),
+            },
+        };
+        vertex_input_info.vertexBindingDescriptionCount = 2;
+        vertex_input_info.pVertexBindingDescriptions = instanced_bindings;
+        vertex_input_info.vertexAttributeDescriptionCount = 4;
+        vertex_input_info.pVertexAttributeDescriptions = instanced_attributes;
+
+        out->instanced_pipeline = vk_create_graphics_pipeline(context, pipeline_create_info, false);
+        if (context->depth_prepass)
+        {
+            out->instanced_prepass_pipeline =
+                vk_create_graphics_pipeline(context, pipeline_create_info, true);
+        }
+        vkDestroyShaderModule(context->logical_device, instanced_mod, NULL);
+        release_shader_code(&instanced_shader);
+    }
+
+    // Because after the graphics pipeline has finished being created all this will have been
+    // compiled to machine code, we can safely free / de-init all our shader code & modules
+    // at the end of pipeline creation:
+    vkDestroyShaderModule(context->logical_device, vert_mod, NULL);
+    vkDestroyShaderModule(context->logical_device, frag_mod, NULL);
+    release_shader_code(&vert_shader);
+    release_shader_code(&frag_shader);
+}
+
+static bool vk_format_is_srgb(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_A8B8G8R8_SRGB_PACK32:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void vk_init_graphics_pipeline(vk_context *context)
+{
+    assert((context->dynamic_rendering || context->render_pass != VK_NULL_HANDLE) &&
+           "expected context->render_pass to be initialized befoore creating graphics pipeline");
+
+    // specify uniform values for the pipeline via the pipeline layout:
+    VkPushConstantRange push_constant_range = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+        .offset = 0,
+        .size = sizeof(draw_push_constants),
+    };
+    // set 0 = everything, bindlessly, set 1 = per-frame uniforms:
+    VkDescriptorSetLayout set_layouts[] = {context->bindless_layout, context->uniform_set_layout};
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 2,
+        .pSetLayouts = set_layouts,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_constant_range,
+    };
+    vk_checked(vkCreatePipelineLayout(context->logical_device, &pipeline_layout_create_info, NULL,
+                                      &context->pipeline_layout));
+
+    // the rest of the features come from the command line / keyboard.  The pipelines themselves
+    // get built by vk_start_pipeline_builds:
+    if (!vk_format_is_srgb(context->swapchain_image_format))
+    {
+        context->pipeline_features |= PIPELINE_FEATURE_ENCODE_SRGB;
+    }
+    dbg("successfully created graphics pipeline layout\n");
+}
+
+// Picks the depth format: D32_SFLOAT if we can render to it, since that's what makes reverse-Z
+// worth it, otherwise D16_UNORM, which every device has to support.
+static VkFormat choose_depth_format(vk_context *context)
+{
+    VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM};
+    for (uint32_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++)
+    {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(context->physical_device, candidates[i], &props);
+        if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+        {
+            return candidates[i];
+        }
+    }
+
+    dbg("fatal: device supports neither D32_SFLOAT nor D16_UNORM depth attachments\n");
+    exit(1);
+}
+
+// Picks the MSAA sample count: the most samples up to `requested` that the device can render both
+// color and depth with.  Sample counts are powers of two, so this rounds down (e.g. 6 -> 4).
+static VkSampleCountFlagBits choose_sample_count(vk_context *context, uint32_t requested)
+{
+    VkPhysicalDeviceLimits *limits = &context->physical_device_props.limits;
+    VkSampleCountFlags supported =
+        limits->framebufferColorSampleCounts & limits->framebufferDepthSampleCounts;
+
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    for (uint32_t count = 2; count <= requested && count <= VK_SAMPLE_COUNT_64_BIT; count <<= 1)
+    {
+        if (supported & count)
+        {
+            samples = (VkSampleCountFlagBits)count;
+        }
+    }
+    if ((uint32_t)samples != requested)
+    {
+        dbg("%d x MSAA isn't supported, using %d x\n", requested, samples);
+    }
+    return samples;
+}
+
+// Creates one of the attachments that only exist while a frame is being rendered (they're cleared
+// on load and never stored), so they're transient and go in lazily allocated memory where there is
+// some: on tiled GPUs they then never get any memory at all.
+static void vk_create_transient_attachment(vk_context *context, VkFormat format,
+                                           VkImageUsageFlags usage, VkImageAspectFlags aspect,
+                                           VkImage *image_out, VkImageView *view_out,
+                                           vk_allocation *allocation_out)
+{
+    VkImageCreateInfo image_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent = {context->swapchain_extent.width, context->swapchain_extent.height, 1},
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = context->msaa_samples,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    vk_create_image(context, &image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, image_out, allocation_out);
+
+    VkImageViewCreateInfo view_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = *image_out,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = format,
+        .subresourceRange =
+            (VkImageSubresourceRange){
+                .aspectMask = aspect,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+    };
+    vk_checked(vkCreateImageView(context->logical_device, &view_info, NULL, view_out));
+}
+
+// Creates the attachments that go with every swapchain image (so each framebuffer gets its own):
+// a depth buffer, and with MSAA the multisampled color image, which gets resolved into the
+// swapchain image at the end of the subpass and then thrown away.
+void vk_init_render_targets(vk_context *context)
+{
+    assert(context->swapchain_image_count > 0 &&
+           "expected the swapchain to be initialized before the render targets");
+
+    if (context->depth_format == VK_FORMAT_UNDEFINED)
+    {
+        context->depth_format = choose_depth_format(context);
+    }
+
+    uint32_t count = context->swapchain_image_count;
+    context->depth_images = calloc(count, sizeof(VkImage));
+    context->depth_views = calloc(count, sizeof(VkImageView));
+    context->depth_allocations = calloc(count, sizeof(vk_allocation));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        vk_create_transient_attachment(context, context->depth_format,
+                                       VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                                       VK_IMAGE_ASPECT_DEPTH_BIT, &context->depth_images[i],
+                                       &context->depth_views[i], &context->depth_allocations[i]);
+    }
+
+    if (context->msaa_samples != VK_SAMPLE_COUNT_1_BIT)
+    {
+        context->msaa_images = calloc(count, sizeof(VkImage));
+        context->msaa_views = calloc(count, sizeof(VkImageView));
+        context->msaa_allocations = calloc(count, sizeof(vk_allocation));
+        for (uint32_t i = 0; i < count; i++)
+        {
+            vk_create_transient_attachment(
+                context, context->swapchain_image_format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+                VK_IMAGE_ASPECT_COLOR_BIT, &context->msaa_images[i], &context->msaa_views[i],
+                &context->msaa_allocations[i]);
+        }
+    }
+
+    dbg("successfully initialized %d render targets (%s depth, %d x MSAA)\n", count,
+        context->depth_format == VK_FORMAT_D32_SFLOAT ? "D32_SFLOAT" : "D16_UNORM",
+        context->msaa_samples);
+}
+
+void vk_init_render_pass(vk_context *context)
+{
+    bool msaa = context->msaa_samples != VK_SAMPLE_COUNT_1_BIT;
+    // images to be presented in the swap chain, or copied out of in headless mode:
+    VkImageLayout present_layout = context->headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                                     : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    // Create an attachment for our color buffer:
+    VkAttachmentDescription color_attachment = {
+        .format = context->swapchain_image_format,
+        .samples = context->msaa_samples,
+        // clear the data in the attachment before and after rendering
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        // keep the rendered contents in memory so we can read them later (unless they're the
+        // multisampled ones, which only matter until they're resolved)
+        .storeOp = msaa ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE,
+        // we are not doing anything with the stencil buffer:
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = msaa ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : present_layout,
+    };
+
+    VkAttachmentReference color_attachment_ref = {
+        .attachment = 0, // this is the index referenced by the `layout(location)` in the shaders
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+
+    // ...and one for depth, which only lives for the length of the render pass:
+    VkAttachmentDescription depth_attachment = {
+        .format = context->depth_format,
+        .samples = context->msaa_samples,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    };
+
+    VkAttachmentReference depth_attachment_ref = {
+        .attachment = 1,
+        .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    };
+
+    // ...and with MSAA, the swapchain image, which the subpass resolves the multisampled color
+    // into when it ends.  Resolving in the subpass (instead of with vkCmdResolveImage afterwards)
+    // means the multisampled image never has to be written out to memory on tiled GPUs:
+    VkAttachmentDescription resolve_attachment = {
+        .format = context->swapchain_image_format,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = present_layout,
+    };
+
+    VkAttachmentReference resolve_attachment_ref = {
+        .attachment = 2,
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+
+    VkSubpassDescription subpass = {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &color_attachment_ref,
+        .pResolveAttachments = msaa ? &resolve_attachment_ref : NULL,
+        .pDepthStencilAttachment = &depth_attachment_ref,
+    };
+
+    VkSubpassDependency dependencies[] = {
+        // Ensure that the render pass waits for the color attachment output bit stage (and that
+        // clearing the depth buffer waits for the last frame that used it to stop testing
+        // against it):
+        {
+            .srcSubpass = VK_SUBPASS_EXTERNAL, // implicit subpass before render
+            .dstSubpass = 0,
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                             VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        },
+        // Headless only: make the readback copy after the render pass wait for our writes:
+        {
+            .srcSubpass = 0,
+            .dstSubpass = VK_SUBPASS_EXTERNAL, // implicit subpass after render
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        },
+    };
+
+    VkAttachmentDescription attachments[] = {color_attachment, depth_attachment,
+                                             resolve_attachment};
+    VkRenderPass render_pass;
+    VkRenderPassCreateInfo render_pass_info = {.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+                                               .attachmentCount = msaa ? 3 : 2,
+                                               .pAttachments = attachments,
+                                               .subpassCount = 1,
+                                               .pSubpasses = &subpass,
+                                               .dependencyCount = context->headless ? 2 : 1,
+                                               .pDependencies = dependencies};
+
+    vk_checked(vkCreateRenderPass(context->logical_device, &render_pass_info, NULL, &render_pass));
+    context->render_pass = render_pass;
+
+    dbg("successfully initialized render pass\n");
+}
+
+void vk_init_frame_buffers(vk_context *context)
+{
+    assert(context->image_views_count > 0 && context->render_pass != VK_NULL_HANDLE &&
+           "expected context image views & render pass to be initialized before frame buffers");
+    VkFramebuffer *swapchain_frame_buffers =
+        calloc(context->image_views_count, sizeof(VkFramebuffer));
+
+    for (uint32_t i = 0; i < context->image_views_count; i++)
+    {
+        // (in vk_init_render_pass' attachment order: color, depth, resolve)
+        VkImageView attachments[] = {
+            context->msaa_views != NULL ? context->msaa_views[i] : context->image_views[i],
+            context->depth_views[i],
+            context->image_views[i],
+        };
+        VkFramebufferCreateInfo create_info = {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = context->render_pass,
+            .attachmentCount = context->msaa_views != NULL ? 3 : 2,
+            .pAttachments = attachments,
+            .width = context->swapchain_extent.width,
+            .height = context->swapchain_extent.height,
+            .layers = 1,
+        };
+
+        vk_checked(vkCreateFramebuffer(context->logical_device, &create_info, NULL,
+                                       &swapchain_frame_buffers[i]));
+    }
+
+    context->framebuffer_count = context->image_views_count;
+    context->framebuffers = swapchain_frame_buffers;
+
+    dbg("successfully initialized frame buffers\n");
+}
+
+void vk_init_command_pool(vk_context *context)
+{
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        // allow command buffers to be re-recorded individually
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = context->queue_indices.graphics,
+    };
+
+    VkCommandPool command_pool;
+    vk_checked(vkCreateCommandPool(context->logical_device, &pool_info, NULL, &command_pool));
+
+    context->command_pool = command_pool;
+    dbg("successfully initialized command pool\n");
+}
+
+void vk_init_command_buffers(vk_context *context)
+{
+    assert(context->command_pool != VK_NULL_HANDLE &&
+           "expected context->command_pool to be initialized before initializing command buffers");
+
+    VkCommandBufferAllocateInfo buffer_alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = context->command_pool,
+        // can be submitted to a queue for execution, but cannot be called from other command
+        // buffers
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        // one per frame in flight so that we can record into one while the GPU is still reading
+        // from another
+        .commandBufferCount = MAX_FRAMES_IN_FLIGHT,
+    };
+
+    vk_checked(vkAllocateCommandBuffers(context->logical_device, &buffer_alloc_info,
+                                        context->command_buffers));
+
+    // and the CMD_RESET_POOL version (we set up both so --cmd-reset compare can switch between
+    // them at runtime):
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        // buffers are short lived (re-recorded every frame), and only ever reset with the pool
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = context->queue_indices.graphics,
+    };
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        vk_checked(vkCreateCommandPool(context->logical_device, &pool_info, NULL,
+                                       &context->frame_command_pools[i]));
+        buffer_alloc_info.commandPool = context->frame_command_pools[i];
+        buffer_alloc_info.commandBufferCount = 1;
+        vk_checked(vkAllocateCommandBuffers(context->logical_device, &buffer_alloc_info,
+                                            &context->frame_command_buffers[i]));
+    }
+
+    dbg("sucessfully initialized %d command buffers\n", MAX_FRAMES_IN_FLIGHT);
+}
+
+static void *job_pool_worker(void *arg)
+{
+    job_pool *pool = arg;
+    uint64_t seen_generation = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;)
+    {
+        while (!pool->shutdown && pool->generation == seen_generation)
+        {
+            pthread_cond_wait(&pool->work_ready, &pool->mutex);
+        }
+        if (pool->shutdown)
+        {
+            break;
+        }
+        seen_generation = pool->generation;
+
+        // jobs are expected to be chunky (a whole command buffer's worth of work), so just
+        // grabbing them one at a time under the lock is fine:
+        while (pool->next_job < pool->job_count)
+        {
+            uint32_t job = pool->next_job++;
+            pthread_mutex_unlock(&pool->mutex);
+            pool->fn(pool->user_data, job);
+            pthread_mutex_lock(&pool->mutex);
+
+            if (--pool->jobs_remaining == 0)
+            {
+                pthread_cond_broadcast(&pool->work_done);
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+job_pool *job_pool_alloc(uint32_t thread_count)
+{
+    assert(thread_count > 0 && thread_count <= MAX_WORKER_THREADS && "invalid worker count");
+    job_pool *pool = calloc(1, sizeof(job_pool));
+    pool->thread_count = thread_count;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        // (pthread functions return their error instead of setting errno)
+        int rc = pthread_create(&pool->threads[i], NULL, job_pool_worker, pool);
+        if (rc != 0)
+        {
+            dbg("could not create worker thread: %s\n", strerror(rc));
+            exit(1);
+        }
+    }
+
+    return pool;
+}
+
+// Starts running `fn(user_data, i)` for every i in [0, job_count) on the worker threads.  Only one
+// batch can be in flight at a time.
+void job_pool_start(job_pool *pool, job_fn fn, void *user_data, uint32_t job_count)
+{
+    pthread_mutex_lock(&pool->mutex);
+    assert(pool->jobs_remaining == 0 && "the previous batch of jobs hasn't finished");
+    pool->fn = fn;
+    pool->user_data = user_data;
+    pool->job_count = job_count;
+    pool->next_job = 0;
+    pool->jobs_remaining = job_count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void job_pool_wait(job_pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->jobs_remaining > 0)
+    {
+        pthread_cond_wait(&pool->work_done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void job_pool_free(job_pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (uint32_t i = 0; i < pool->thread_count; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool);
+}
+
+// Bindless descriptors: instead of a descriptor set per material / object / whatever, every buffer
+// and texture the shaders can see lives in one big descriptor set, and draws say which ones they
+// want with indices in push constants.  The set is bound once per command buffer, so there's no
+// per-draw vkCmdBindDescriptorSets, and it's update-after-bind, so registering something new
+// doesn't have to wait for (or invalidate) command buffers that already have the set bound.
+static uint32_t min_u32(uint32_t a, uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+void vk_init_bindless(vk_context *context)
+{
+    // Update-after-bind descriptors have their own (sometimes much lower) limits, per stage and
+    // per set.  A combined image sampler counts as both a sampled image and a sampler, and
+    // everything counts towards the per stage resource total, where we leave room for set 1's
+    // uniform buffer.
+    VkPhysicalDeviceDescriptorIndexingProperties limits = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES,
+    };
+    VkPhysicalDeviceProperties2 props = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &limits,
+    };
+    vkGetPhysicalDeviceProperties2(context->physical_device, &props);
+    uint32_t buffers = min_u32(MAX_BINDLESS_BUFFERS,
+                               min_u32(limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+                                       limits.maxDescriptorSetUpdateAfterBindStorageBuffers));
+    uint32_t images = min_u32(MAX_BINDLESS_IMAGES,
+                              min_u32(limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                      limits.maxDescriptorSetUpdateAfterBindSampledImages));
+    images = min_u32(images, min_u32(limits.maxPerStageDescriptorUpdateAfterBindSamplers,
+                                     limits.maxDescriptorSetUpdateAfterBindSamplers));
+    uint32_t resources = limits.maxPerStageUpdateAfterBindResources;
+    buffers = min_u32(buffers, resources > 1 ? resources - 1 : 0);
+    images = min_u32(images, resources > buffers + 1 ? resources - buffers - 1 : 0);
+    if (buffers == 0 || images == 0)
+    {
+        dbg("fatal: device can't do update-after-bind storage buffers and images\n");
+        exit(1);
+    }
+    context->bindless_buffer_capacity = buffers;
+    context->bindless_image_capacity = images;
+
+    VkDescriptorSetLayoutBinding bindings[] = {
+        {
+            .binding = BINDLESS_BUFFER_BINDING,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = buffers,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+        },
+        {
+            .binding = BINDLESS_IMAGE_BINDING,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = images,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+        },
+    };
+    // Most of the slots are empty most of the time (partially bound), and new ones get filled in
+    // while frames that use the set are in flight (update after bind + unused while pending):
+    VkDescriptorBindingFlags binding_flags[] = {
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+    };
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .bindingCount = 2,
+        .pBindingFlags = binding_flags,
+    };
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &flags_info,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = 2,
+        .pBindings = bindings,
+    };
+    vk_checked(vkCreateDescriptorSetLayout(context->logical_device, &layout_info, NULL,
+                                           &context->bindless_layout));
+
+    // (update-after-bind sets have to come from an update-after-bind pool, so this can't share
+    // context->descriptor_pool)
+    VkDescriptorPoolSize pool_sizes[] = {
+        {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = buffers},
+        {.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = images},
+    };
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = 2,
+        .pPoolSizes = pool_sizes,
+    };
+    vk_checked(vkCreateDescriptorPool(context->logical_device, &pool_info, NULL,
+                                      &context->bindless_pool));
+
+    VkDescriptorSetAllocateInfo set_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = context->bindless_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &context->bindless_layout,
+    };
+    vk_checked(
+        vkAllocateDescriptorSets(context->logical_device, &set_info, &context->bindless_set));
+    context->bindless_free_images = calloc(images, sizeof(uint32_t));
+
+    dbg("successfully initialized bindless descriptors (%d buffers, %d images)\n", buffers,
+        images);
+}
+
+// Puts `buffer` (all of it) in the next free storage buffer slot of the bindless set, and returns
+// the index the shaders should use for it.
+uint32_t vk_bindless_add_buffer(vk_context *context, VkBuffer buffer)
+{
+    if (context->bindless_buffer_count == context->bindless_buffer_capacity)
+    {
+        dbg("fatal: ran out of bindless buffer slots (%d)\n", context->bindless_buffer_capacity);
+        exit(1);
+    }
+    uint32_t index = context->bindless_buffer_count++;
+
+    VkDescriptorBufferInfo buffer_info = {
+        .buffer = buffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = context->bindless_set,
+        .dstBinding = BINDLESS_BUFFER_BINDING,
+        .dstArrayElement = index,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &buffer_info,
+    };
+    vkUpdateDescriptorSets(context->logical_device, 1, &write, 0, NULL);
+    return index;
+}
+
+// Same as vk_bindless_add_buffer, for a sampled image (which must be in SHADER_READ_ONLY_OPTIMAL
+// by the time anything samples it).
+uint32_t vk_bindless_add_image(vk_context *context, VkImageView view, VkSampler sampler)
+{
+    uint32_t index;
+    if (context->bindless_free_image_count > 0)
+    {
+        index = context->bindless_free_images[--context->bindless_free_image_count];
+    }
+    else if (context->bindless_image_count < context->bindless_image_capacity)
+    {
+        index = context->bindless_image_count++;
+    }
+    else
+    {
+        dbg("fatal: ran out of bindless image slots (%d)\n", context->bindless_image_capacity);
+        exit(1);
+    }
+
+    VkDescriptorImageInfo image_info = {
+        .sampler = sampler,
+        .imageView = view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = context->bindless_set,
+        .dstBinding = BINDLESS_IMAGE_BINDING,
+        .dstArrayElement = index,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &image_info,
+    };
+    vkUpdateDescriptorSets(context->logical_device, 1, &write, 0, NULL);
+    return index;
+}
+
+// Gives an image slot back for vk_bindless_add_image to hand out again.  The slot is partially
+// bound, so it's fine to leave the stale descriptor in it, but no frame that's still in flight may
+// be using it.
+void vk_bindless_release_image(vk_context *context, uint32_t index)
+{
+    assert(index < context->bindless_image_count && "not a bindless image slot");
+    context->bindless_free_images[context->bindless_free_image_count++] = index;
+}
+
+// Texture streaming.  Textures are KTX2 files (see ktx2.h) of anything the device can sample
+// directly, i.e. BCn or friends; nothing gets transcoded.  Each texture keeps a suffix of its mip
+// chain on the GPU: the "mip tail" (every level of TEXTURE_MIP_TAIL_SIZE or less) is always
+// resident, and the levels above it are only loaded while something on screen is big enough to
+// need them.  All of it has to fit in the texture budget, and when it doesn't, the least recently
+// used textures drop back towards their tail first.
+//
+// Changing what's resident means building a new image with the new set of levels and switching the
+// texture's bindless slot over to it, which keeps this working without sparse residency.  The
+// streaming thread reads the levels out of the (mapped) file into the texture staging ring, and
+// the main thread then creates the image and records the copies at the start of the next frame.
+// Copying on the graphics queue keeps images away from queue family ownership transfers, and the
+// slot switch happens in the same frame as the copies, so nothing ever samples a half-loaded image.
+
+// Levels with both sides at most this big are always resident:
+#define TEXTURE_MIP_TAIL_SIZE 128
+// Texture memory budget if there's no --texture-budget and no VK_EXT_memory_budget to go by:
+#define DEFAULT_TEXTURE_BUDGET (256ull * 1024 * 1024)
+// Only use this much of what VK_EXT_memory_budget says is left, so we don't fight the rest of the
+// app (or other apps) for the last few bytes:
+#define TEXTURE_BUDGET_HEADROOM 0.8
+// How often (in frames) to ask VK_EXT_memory_budget again:
+#define TEXTURE_BUDGET_INTERVAL 16
+#define TEXTURE_STAGING_SIZE (64ull * 1024 * 1024)
+// The most one load may take up in the staging ring, so that a few can be in flight at once (like
+// the uploader's chunks).  Textures whose top levels don't fit never get them loaded.
+#define TEXTURE_MAX_LOAD_SIZE (TEXTURE_STAGING_SIZE / 4)
+// Loads that can be in flight at once (queued, being read, or waiting for their copies to finish):
+#define MAX_TEXTURE_REQUESTS 8
+// Every texture swaps images at most once a frame and the old one is gone MAX_FRAMES_IN_FLIGHT
+// frames later, so this can't fill up:
+#define MAX_RETIRED_TEXTURES (MAX_TEXTURES * MAX_FRAMES_IN_FLIGHT)
+
+typedef struct vk_texture
+{
+    char *path;
+    // the whole file, mapped
+    const uint8_t *file;
+    size_t file_size;
+    const ktx2_level *levels;
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t level_count;
+    // first level of the mip tail, and the biggest level we'll ever load (the first one whose
+    // chain fits in TEXTURE_MAX_LOAD_SIZE)
+    uint32_t tail_level;
+    uint32_t first_level;
+    // Levels below the file's that we build on the GPU after loading level 0, for files that ask
+    // for their mips to be generated.  These only ever have the one file level, so they're
+    // loaded once and stay resident.
+    uint32_t generated_levels;
+    // generate them with shaders/mipgen.comp instead of blits, which needs a view of every level
+    // and a descriptor set per generated level
+    bool generate_with_compute;
+    VkImageView level_views[KTX2_MAX_LEVELS];
+    VkDescriptorSet mip_sets[KTX2_MAX_LEVELS];
+
+    // what's on the GPU: levels [resident_level, level_count) in `image`, and the bindless slot of
+    // its view (NO_TEXTURE until the tail has been loaded)
+    VkImage image;
+    VkImageView view;
+    vk_allocation allocation;
+    uint32_t resident_level;
+    uint32_t slot;
+
+    // the level we'd like to have resident, from the last vk_update_textures
+    uint32_t wanted_level;
+    bool loading;
+    // frame_number of the last frame where something visible used it, for LRU eviction
+    uint64_t last_used;
+} vk_texture;
+
+typedef struct vk_texture_request
+{
+    uint32_t texture;
+    uint32_t top_level;
+    // where the streaming thread put the levels, as offsets into the staging buffer, and the end
+    // of its part of the ring
+    VkDeviceSize level_offsets[KTX2_MAX_LEVELS];
+    VkDeviceSize ring_end;
+    // frame_number of the frame that copied out of the staging ring
+    uint64_t uploaded_at;
+} vk_texture_request;
+
+// An image that was replaced, waiting for the frames that sampled it to finish:
+typedef struct vk_retired_texture
+{
+    VkImage image;
+    VkImageView view;
+    vk_allocation allocation;
+    uint32_t slot;
+    uint64_t retired_at;
+} vk_retired_texture;
+
+typedef struct vk_texture_streamer
+{
+    uint32_t texture_count;
+    vk_texture textures[MAX_TEXTURES];
+    VkSampler sampler;
+
+    // shaders/mipgen.comp, only set up if a texture needs it
+    VkDescriptorSetLayout mip_set_layout;
+    VkPipelineLayout mip_pipeline_layout;
+    VkPipeline mip_pipeline;
+    VkDescriptorPool mip_pool;
+    // --texture-budget, or 0 to go by VK_EXT_memory_budget / DEFAULT_TEXTURE_BUDGET
+    VkDeviceSize budget_override;
+    VkDeviceSize budget;
+    // bytes of levels that are resident
+    VkDeviceSize resident_bytes;
+
+    VkBuffer staging_buffer;
+    vk_allocation staging_allocation;
+
+    // Requests are a ring with monotonic counters: [released, uploaded) have had their copies
+    // recorded and wait for the GPU to finish them, [uploaded, loaded) are in the staging ring
+    // waiting for the main thread, and [loaded, submitted) are waiting for the streaming thread.
+    vk_texture_request requests[MAX_TEXTURE_REQUESTS];
+    uint64_t released;
+    uint64_t uploaded;
+    // requests [first_recorded, uploaded) still need their copies recorded into this frame
+    uint64_t first_recorded;
+
+    pthread_t thread;
+    // guards loaded / submitted / head / tail / stop
+    pthread_mutex_t mutex;
+    // signaled when there's a new request, staging space was freed, or it's time to stop
+    pthread_cond_t wake;
+    uint64_t loaded;
+    uint64_t submitted;
+    // like the uploader's ring: head and tail only ever grow
+    VkDeviceSize head;
+    VkDeviceSize tail;
+    bool stop;
+
+    uint32_t retired_count;
+    vk_retired_texture retired[MAX_RETIRED_TEXTURES];
+} vk_texture_streamer;
+
+// Size of a mip level's side:
+static uint32_t mip_extent(uint32_t size, uint32_t level)
+{
+    return size >> level > 0 ? size >> level : 1;
+}
+
+// Room the levels from `top_level` down take up in the staging ring, where every level starts 16
+// byte aligned (which covers the copy alignment rules for block compressed formats):
+static VkDeviceSize texture_staging_bytes(const vk_texture *texture, uint32_t top_level)
+{
+    VkDeviceSize size = 0;
+    for (uint32_t i = top_level; i < texture->level_count; i++)
+    {
+        size += (texture->levels[i].byte_length + 15) & ~15ull;
+    }
+    return size;
+}
+
+static VkDeviceSize texture_level_bytes(const vk_texture *texture, uint32_t top_level)
+{
+    VkDeviceSize bytes = 0;
+    for (uint32_t i = top_level; i < texture->level_count; i++)
+    {
+        bytes += texture->levels[i].byte_length;
+    }
+    // a generated chain adds about a third on top of level 0:
+    if (texture->generated_levels > 0 && top_level == 0)
+    {
+        bytes += bytes / 3;
+    }
+    return bytes;
+}
+
+// Size in bytes of a texel block of `format` (a single texel for uncompressed formats), and its
+// size in texels.  Only knows the formats it's reasonable to make a texture file out of; returns
+// false for the rest.
+static bool format_block_size(VkFormat format, uint32_t *block_bytes, uint32_t *block_width,
+                              uint32_t *block_height)
+{
+    *block_width = 1;
+    *block_height = 1;
+    switch (format)
+    {
+    case VK_FORMAT_R8_UNORM:
+    case VK_FORMAT_R8_SRGB:
+        *block_bytes = 1;
+        return true;
+    case VK_FORMAT_R8G8_UNORM:
+    case VK_FORMAT_R8G8_SRGB:
+    case VK_FORMAT_R16_SFLOAT:
+        *block_bytes = 2;
+        return true;
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+    case VK_FORMAT_R16G16_SFLOAT:
+    case VK_FORMAT_R32_SFLOAT:
+    case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+    case VK_FORMAT_E5B9G9R9_UFLOAT_PACK32:
+        *block_bytes = 4;
+        return true;
+    case VK_FORMAT_R16G16B16A16_UNORM:
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+    case VK_FORMAT_R32G32_SFLOAT:
+        *block_bytes = 8;
+        return true;
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+        *block_bytes = 16;
+        return true;
+    default:
+        break;
+    }
+
+    // Block compressed formats, all of which are contiguous ranges of the enum.  BC1 and BC4, the
+    // 8 bit ETC2 ones and single channel EAC have 8 byte blocks, everything else has 16:
+    *block_width = 4;
+    *block_height = 4;
+    if (format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK)
+    {
+        bool small = format < VK_FORMAT_BC2_UNORM_BLOCK ||
+                     format == VK_FORMAT_BC4_UNORM_BLOCK || format == VK_FORMAT_BC4_SNORM_BLOCK;
+        *block_bytes = small ? 8 : 16;
+        return true;
+    }
+    if (format >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK && format <= VK_FORMAT_EAC_R11G11_SNORM_BLOCK)
+    {
+        bool small = format < VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK ||
+                     format == VK_FORMAT_EAC_R11_UNORM_BLOCK ||
+                     format == VK_FORMAT_EAC_R11_SNORM_BLOCK;
+        *block_bytes = small ? 8 : 16;
+        return true;
+    }
+    // ASTC blocks are always 16 bytes, but come in lots of sizes (each as UNORM then SRGB):
+    if (format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK)
+    {
+        static const uint8_t astc_sizes[][2] = {
+            {4, 4},  {5, 4},  {5, 5},  {6, 5},   {6, 6},   {8, 5},   {8, 6},
+            {8, 8},  {10, 5}, {10, 6}, {10, 8},  {10, 10}, {12, 10}, {12, 12},
+        };
+        uint32_t index = (format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2;
+        *block_bytes = 16;
+        *block_width = astc_sizes[index][0];
+        *block_height = astc_sizes[index][1];
+        return true;
+    }
+    return false;
+}
+
+// Maps a KTX2 file and checks that we can use it.  Returns false (after saying why) if not.
+static bool vk_open_texture(vk_context *context, const char *path, vk_texture *texture)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        dbg("could not open texture %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    void *file = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        file = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (file == MAP_FAILED)
+    {
+        dbg("could not map texture %s\n", path);
+        return false;
+    }
+
+    const ktx2_header *header = file;
+    const char *problem = NULL;
+    VkFormatProperties props = {0};
+    uint32_t block_bytes, block_width, block_height;
+    if (!ktx2_valid(file, (size_t)st.st_size))
+    {
+        problem = "not a (valid) KTX2 file";
+    }
+    else if (header->supercompression_scheme != KTX2_SUPERCOMPRESSION_NONE)
+    {
+        problem = "supercompressed";
+    }
+    else if (header->pixel_height == 0 || header->pixel_depth > 1 || header->layer_count > 1 ||
+             header->face_count > 1)
+    {
+        problem = "not a plain 2D texture";
+    }
+    else if (!format_block_size(header->vk_format, &block_bytes, &block_width, &block_height))
+    {
+        problem = "in a format we don't know the block size of";
+    }
+    else
+    {
+        vkGetPhysicalDeviceFormatProperties(context->physical_device, header->vk_format, &props);
+        if (header->vk_format == VK_FORMAT_UNDEFINED ||
+            !(props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+        {
+            problem = "in a format the device can't sample";
+        }
+    }
+    // every level has to hold at least as many blocks as its size needs, or the copies would read
+    // past it (and maybe past the staging buffer):
+    const ktx2_level *levels = (const ktx2_level *)(header + 1);
+    uint32_t level_count = header->level_count > 0 ? header->level_count : 1;
+    for (uint32_t i = 0; problem == NULL && i < level_count; i++)
+    {
+        uint64_t blocks_x = (mip_extent(header->pixel_width, i) + block_width - 1) / block_width;
+        uint64_t blocks_y = (mip_extent(header->pixel_height, i) + block_height - 1) / block_height;
+        if (levels[i].byte_length < blocks_x * blocks_y * block_bytes)
+        {
+            problem = "a level is smaller than its size and format need";
+        }
+    }
+    if (problem != NULL)
+    {
+        dbg("skipping texture %s: %s\n", path, problem);
+        munmap(file, (size_t)st.st_size);
+        return false;
+    }
+
+    *texture = (vk_texture){
+        .path = strdup(path),
+        .file = file,
+        .file_size = (size_t)st.st_size,
+        .levels = levels,
+        .format = header->vk_format,
+        .width = header->pixel_width,
+        .height = header->pixel_height,
+        .level_count = level_count,
+        .generated_levels = 0,
+        .generate_with_compute = false,
+        .image = VK_NULL_HANDLE,
+        .view = VK_NULL_HANDLE,
+        .slot = NO_TEXTURE,
+        .loading = false,
+        .last_used = 0,
+    };
+    // the tail starts at the first level that fits in TEXTURE_MIP_TAIL_SIZE (or is the last one):
+    texture->tail_level = 0;
+    while (texture->tail_level + 1 < texture->level_count &&
+           ((texture->width >> texture->tail_level) > TEXTURE_MIP_TAIL_SIZE ||
+            (texture->height >> texture->tail_level) > TEXTURE_MIP_TAIL_SIZE))
+    {
+        texture->tail_level++;
+    }
+    // Big textures (8k BC7, 4k RGBA16F, ...) can have more in their top levels than one load can
+    // stage, so those levels are left out.  If not even the last level fits, forget it:
+    texture->first_level = 0;
+    while (texture->first_level < texture->level_count &&
+           texture_staging_bytes(texture, texture->first_level) > TEXTURE_MAX_LOAD_SIZE)
+    {
+        texture->first_level++;
+    }
+    if (texture->first_level == texture->level_count)
+    {
+        dbg("skipping texture %s: too big to stage\n", path);
+        munmap(file, (size_t)st.st_size);
+        return false;
+    }
+    if (texture->first_level > 0)
+    {
+        dbg("texture %s is too big to stage whole, loading it from level %d\n", path,
+            texture->first_level);
+    }
+    if (texture->tail_level < texture->first_level)
+    {
+        texture->tail_level = texture->first_level;
+    }
+
+    // A level count of 0 means the file only has level 0 and wants the rest generated.  Blitting
+    // each level from the one above is the usual way, but it needs linear filtering in blits,
+    // which plenty of formats (mostly the integer and some 16/32 bit float ones) don't have.  The
+    // compute fallback only needs the format to be usable as a storage image.
+    if (header->level_count == 0 && (texture->width > 1 || texture->height > 1))
+    {
+        uint32_t size = texture->width > texture->height ? texture->width : texture->height;
+        while (size > 1 && texture->generated_levels + 1 < KTX2_MAX_LEVELS)
+        {
+            texture->generated_levels++;
+            size >>= 1;
+        }
+        VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                                    VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                    VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if ((props.optimalTilingFeatures & blit) == blit)
+        {
+            dbg("generating mips for texture %s with blits\n", path);
+        }
+        else if ((props.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) &&
+                 context->storage_write_without_format)
+        {
+            dbg("generating mips for texture %s in a compute shader\n", path);
+            texture->generate_with_compute = true;
+        }
+        else
+        {
+            dbg("can't generate mips for texture %s in its format, using level 0 only\n", path);
+            texture->generated_levels = 0;
+        }
+    }
+
+    // nothing is resident yet, which is the same as "everything above the end of the chain":
+    texture->resident_level = texture->level_count;
+    texture->wanted_level = texture->tail_level;
+    return true;
+}
+
+// The streaming thread: copies the levels of every submitted request out of the mapped file into
+// the staging ring.  Reading from the mapping is where the disk I/O actually happens, which is the
+// slow part we want off the main thread.
+static void *texture_stream_thread(void *arg)
+{
+    vk_context *context = arg;
+    vk_texture_streamer *streamer = context->textures;
+
+    pthread_mutex_lock(&streamer->mutex);
+    for (;;)
+    {
+        while (!streamer->stop && streamer->loaded == streamer->submitted)
+        {
+            pthread_cond_wait(&streamer->wake, &streamer->mutex);
+        }
+        if (streamer->stop)
+        {
+            break;
+        }
+
+        vk_texture_request *request =
+            &streamer->requests[streamer->loaded % MAX_TEXTURE_REQUESTS];
+        vk_texture *texture = &streamer->textures[request->texture];
+
+        // Reserve room for all of the levels (vk_open_texture made sure they fit).  Like the
+        // uploader's ring, reservations don't wrap around the end:
+        VkDeviceSize size = texture_staging_bytes(texture, request->top_level);
+        assert(size <= TEXTURE_MAX_LOAD_SIZE && "texture load bigger than TEXTURE_MAX_LOAD_SIZE");
+        VkDeviceSize start = streamer->head;
+        if (start % TEXTURE_STAGING_SIZE + size > TEXTURE_STAGING_SIZE)
+        {
+            start += TEXTURE_STAGING_SIZE - start % TEXTURE_STAGING_SIZE;
+        }
+        while (!streamer->stop && start + size - streamer->tail > TEXTURE_STAGING_SIZE)
+        {
+            pthread_cond_wait(&streamer->wake, &streamer->mutex);
+        }
+        if (streamer->stop)
+        {
+            break;
+        }
+        streamer->head = start + size;
+        pthread_mutex_unlock(&streamer->mutex);
+
+        VkDeviceSize offset = start % TEXTURE_STAGING_SIZE;
+        for (uint32_t i = request->top_level; i < texture->level_count; i++)
+        {
+            memcpy((char *)streamer->staging_allocation.mapped + offset,
+                   texture->file + texture->levels[i].byte_offset, texture->levels[i].byte_length);
+            request->level_offsets[i] = offset;
+            offset += (texture->levels[i].byte_length + 15) & ~15ull;
+        }
+        request->ring_end = start + size;
+
+        pthread_mutex_lock(&streamer->mutex);
+        streamer->loaded++;
+    }
+    pthread_mutex_unlock(&streamer->mutex);
+    return NULL;
+}
+
+// Sets up shaders/mipgen.comp for the textures that can't generate their mips with blits.  The
+// pipeline is built right here rather than with the startup builds, since hardly any texture needs
+// it.
+static void vk_init_mip_generation(vk_context *context)
+{
+    vk_texture_streamer *streamer = context->textures;
+
+    // the level above, and the level to write:
+    VkDescriptorSetLayoutBinding bindings[] = {
+        {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+    };
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 2,
+        .pBindings = bindings,
+    };
+    vk_checked(vkCreateDescriptorSetLayout(context->logical_device, &layout_info, NULL,
+                                           &streamer->mip_set_layout));
+
+    VkPushConstantRange push_constant_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(mip_push_constants),
+    };
+    VkPipelineLayoutCreateInfo pipeline_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &streamer->mip_set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_constant_range,
+    };
+    vk_checked(vkCreatePipelineLayout(context->logical_device, &pipeline_layout_info, NULL,
+                                      &streamer->mip_pipeline_layout));
+
+    shader_code mip_shader = vk_load_shader(context, "mipgen.comp", VK_SHADER_STAGE_COMPUTE_BIT);
+    VkShaderModule mip_mod = create_shader_module(context, &mip_shader);
+    VkComputePipelineCreateInfo pipeline_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage =
+            (VkPipelineShaderStageCreateInfo){
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                .module = mip_mod,
+                .pName = mip_shader.entry_point,
+            },
+        .layout = streamer->mip_pipeline_layout,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1,
+    };
+    vk_checked(vkCreateComputePipelines(context->logical_device, context->pipeline_cache, 1,
+                                        &pipeline_info, NULL, &streamer->mip_pipeline));
+    vkDestroyShaderModule(context->logical_device, mip_mod, NULL);
+    release_shader_code(&mip_shader);
+
+    // enough sets for every level of every texture:
+    uint32_t set_count = MAX_TEXTURES * (KTX2_MAX_LEVELS - 1);
+    VkDescriptorPoolSize pool_sizes[] = {
+        {.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = set_count},
+        {.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, .descriptorCount = set_count},
+    };
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = set_count,
+        .poolSizeCount = 2,
+        .pPoolSizes = pool_sizes,
+    };
+    vk_checked(
+        vkCreateDescriptorPool(context->logical_device, &pool_info, NULL, &streamer->mip_pool));
+}
+
+// Sets up streaming for the KTX2 files in `paths`.  Nothing gets loaded here: the first
+// vk_update_textures asks for every texture's mip tail, and objects are drawn untextured until
+// theirs arrives.  Files we can't use are skipped.
+void vk_init_textures(vk_context *context, const char **paths, uint32_t path_count,
+                      VkDeviceSize budget)
+{
+    vk_texture_streamer *streamer = calloc(1, sizeof(vk_texture_streamer));
+    context->textures = streamer;
+    bool need_mip_shader = false;
+    for (uint32_t i = 0; i < path_count && streamer->texture_count < MAX_TEXTURES; i++)
+    {
+        // if there's a variant of foo.ktx2 in the device's compressed format (foo.bc7.ktx2 and
+        // so on) we load that instead:
+        char variant[PATH_MAX];
+        const char *path = paths[i];
+        if (context->texture_compression != NULL)
+        {
+            size_t stem = strlen(path);
+            if (stem > 5 && strcmp(path + stem - 5, ".ktx2") == 0)
+            {
+                stem -= 5;
+            }
+            snprintf(variant, sizeof(variant), "%.*s.%s.ktx2", (int)stem, path,
+                     context->texture_compression->suffix);
+            if (access(variant, R_OK) == 0)
+            {
+                path = variant;
+            }
+        }
+
+        vk_texture *texture = &streamer->textures[streamer->texture_count];
+        if (vk_open_texture(context, path, texture))
+        {
+            need_mip_shader |= texture->generate_with_compute;
+            streamer->texture_count++;
+        }
+    }
+    if (need_mip_shader)
+    {
+        vk_init_mip_generation(context);
+    }
+
+    VkSamplerCreateInfo sampler_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_LINEAR,
+        .minFilter = VK_FILTER_LINEAR,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .minLod = 0.0f,
+        .maxLod = VK_LOD_CLAMP_NONE,
+    };
+    vk_checked(
+        vkCreateSampler(context->logical_device, &sampler_info, NULL, &streamer->sampler));
+
+    vk_create_buffer(context, TEXTURE_STAGING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     0, &streamer->staging_buffer, &streamer->staging_allocation);
+
+    streamer->budget_override = budget;
+    streamer->budget = budget > 0 ? budget : DEFAULT_TEXTURE_BUDGET;
+    pthread_mutex_init(&streamer->mutex, NULL);
+    pthread_cond_init(&streamer->wake, NULL);
+    int rc = pthread_create(&streamer->thread, NULL, texture_stream_thread, context);
+    if (rc != 0)
+    {
+        dbg("could not create texture streaming thread: %s\n", strerror(rc));
+        exit(1);
+    }
+
+    dbg("successfully initialized texture streaming (%d of %d textures)\n",
+        streamer->texture_count, path_count);
+}
+
+// Works out how much memory the textures may use: whatever --texture-budget said, capped to what
+// VK_EXT_memory_budget says is left in the biggest device local heap once everything else in it
+// is accounted for.
+static void vk_update_texture_budget(vk_context *context)
+{
+    vk_texture_streamer *streamer = context->textures;
+    if (!context->memory_budget || context->frame_number % TEXTURE_BUDGET_INTERVAL != 0)
+    {
+        return;
+    }
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT heap_budget = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+    };
+    VkPhysicalDeviceMemoryProperties2 props = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+        .pNext = &heap_budget,
+    };
+    vkGetPhysicalDeviceMemoryProperties2(context->physical_device, &props);
+
+    uint32_t heap = UINT32_MAX;
+    for (uint32_t i = 0; i < props.memoryProperties.memoryHeapCount; i++)
+    {
+        VkMemoryHeap *candidate = &props.memoryProperties.memoryHeaps[i];
+        if ((candidate->flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) &&
+            (heap == UINT32_MAX || candidate->size > props.memoryProperties.memoryHeaps[heap].size))
+        {
+            heap = i;
+        }
+    }
+    if (heap == UINT32_MAX)
+    {
+        return;
+    }
+
+    // (our own textures are part of heapUsage, and they're what we're budgeting for)
+    VkDeviceSize usage = heap_budget.heapUsage[heap];
+    VkDeviceSize others = usage > streamer->resident_bytes ? usage - streamer->resident_bytes : 0;
+    VkDeviceSize available =
+        heap_budget.heapBudget[heap] > others
+            ? (VkDeviceSize)((heap_budget.heapBudget[heap] - others) * TEXTURE_BUDGET_HEADROOM)
+            : 0;
+    streamer->budget = streamer->budget_override > 0 && streamer->budget_override < available
+                           ? streamer->budget_override
+                           : available;
+}
+
+// Frees the staging space and old images of loads whose frames the GPU has finished.
+static void vk_release_texture_loads(vk_context *context)
+{
+    vk_texture_streamer *streamer = context->textures;
+    VkDeviceSize tail = 0;
+    bool freed = false;
+    while (streamer->released < streamer->uploaded)
+    {
+        vk_texture_request *request =
+            &streamer->requests[streamer->released % MAX_TEXTURE_REQUESTS];
+        // (the same rule as vk_destroy_retired_swap_chains, for a frame that's already over)
+        if (context->frame_number + 1 < request->uploaded_at + 1 + MAX_FRAMES_IN_FLIGHT)
+        {
+            break;
+        }
+        tail = request->ring_end;
+        freed = true;
+        streamer->released++;
+    }
+    if (freed)
+    {
+        pthread_mutex_lock(&streamer->mutex);
+        streamer->tail = tail;
+        pthread_cond_signal(&streamer->wake);
+        pthread_mutex_unlock(&streamer->mutex);
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < streamer->retired_count; i++)
+    {
+        vk_retired_texture *retired = &streamer->retired[i];
+        if (context->frame_number + 1 < retired->retired_at + MAX_FRAMES_IN_FLIGHT)
+        {
+            streamer->retired[kept++] = *retired;
+            continue;
+        }
+        vk_bindless_release_image(context, retired->slot);
+        vkDestroyImageView(context->logical_device, retired->view, NULL);
+        vkDestroyImage(context->logical_device, retired->image, NULL);
+        vk_free(context, &retired->allocation);
+    }
+    streamer->retired_count = kept;
+}
+
+// Decides which levels every texture should have resident this frame.  The level an object needs
+// is the one where a texel is about a pixel on screen; objects that are off screen don't need any
+// (beyond the tail).
+static void vk_choose_texture_levels(vk_context *context)
+{
+    vk_texture_streamer *streamer = context->textures;
+    for (uint32_t i = 0; i < streamer->texture_count; i++)
+    {
+        streamer->textures[i].wanted_level = streamer->textures[i].tail_level;
+    }
+
+    // same test as the culling shader:
+    float half_extent = 1.0f / context->camera_zoom;
+    float pixels_per_unit = context->camera_zoom * context->swapchain_extent.height / 2.0f;
+    for (uint32_t i = 0; i < context->draw_count; i++)
+    {
+        gpu_object *object = &context->objects[i];
+        if (object->texture == NO_TEXTURE ||
+            object->center[0] + object->radius < context->camera_center[0] - half_extent ||
+            object->center[0] - object->radius > context->camera_center[0] + half_extent ||
+            object->center[1] + object->radius < context->camera_center[1] - half_extent ||
+            object->center[1] - object->radius > context->camera_center[1] + half_extent)
+        {
+            continue;
+        }
+
+        // the mesh's UVs span one unit of object space:
+        vk_texture *texture = &streamer->textures[object->texture];
+        float pixels = object->scale * pixels_per_unit;
+        uint32_t level = texture->first_level;
+        while (level < texture->tail_level && (texture->width >> (level + 1)) >= pixels)
+        {
+            level++;
+        }
+        if (level < texture->wanted_level)
+        {
+            texture->wanted_level = level;
+        }
+        texture->last_used = context->frame_number;
+    }
+
+    // Over budget: take a level off the least recently used texture that has anything above its
+    // tail until it fits.  (The tails don't count against the budget, since we can't evict them.)
+    VkDeviceSize wanted_bytes = 0;
+    for (uint32_t i = 0; i < streamer->texture_count; i++)
+    {
+        vk_texture *texture = &streamer->textures[i];
+        wanted_bytes += texture_level_bytes(texture, texture->wanted_level) -
+                        texture_level_bytes(texture, texture->tail_level);
+    }
+    while (wanted_bytes > streamer->budget)
+    {
+        vk_texture *lru = NULL;
+        for (uint32_t i = 0; i < streamer->texture_count; i++)
+        {
+            vk_texture *texture = &streamer->textures[i];
+            if (texture->wanted_level < texture->tail_level &&
+                (lru == NULL || texture->last_used < lru->last_used))
+            {
+                lru = texture;
+            }
+        }
+        if (lru == NULL)
+        {
+            break;
+        }
+        wanted_bytes -= lru->levels[lru->wanted_level].byte_length;
+        lru->wanted_level++;
+    }
+}
+
+// Swaps a loaded request's levels in: creates the new image, points the texture (and a fresh
+// bindless slot) at it, and retires the old one.  The copies get recorded by
+// vk_record_texture_uploads.
+static void vk_finish_texture_load(vk_context *context, vk_texture_request *request)
+{
+    vk_texture_streamer *streamer = context->textures;
+    vk_texture *texture = &streamer->textures[request->texture];
+    uint32_t top = request->top_level;
+
+    VkImageCreateInfo image_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = texture->format,
+        .extent = {texture->width >> top > 0 ? texture->width >> top : 1,
+                   texture->height >> top > 0 ? texture->height >> top : 1, 1},
+        .mipLevels = texture->level_count - top + texture->generated_levels,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    if (texture->generated_levels > 0)
+    {
+        assert(texture->image == VK_NULL_HANDLE && "textures with generated mips only load once");
+        image_info.usage |= texture->generate_with_compute ? VK_IMAGE_USAGE_STORAGE_BIT
+                                                           : VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+    VkImage image;
+    vk_allocation allocation;
+    vk_create_image(context, &image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &image,
+                    &allocation);
+
+    VkImageViewCreateInfo view_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = texture->format,
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, image_info.mipLevels, 0, 1},
+    };
+    VkImageView view;
+    vk_checked(vkCreateImageView(context->logical_device, &view_info, NULL, &view));
+
+    // shaders/mipgen.comp reads each level from the one above through a single level view
+    if (texture->generate_with_compute)
+    {
+        for (uint32_t level = 0; level < image_info.mipLevels; level++)
+        {
+            view_info.subresourceRange.baseMipLevel = level;
+            view_info.subresourceRange.levelCount = 1;
+            vk_checked(vkCreateImageView(context->logical_device, &view_info, NULL,
+                                         &texture->level_views[level]));
+        }
+        for (uint32_t level = 1; level < image_info.mipLevels; level++)
+        {
+            VkDescriptorSetAllocateInfo set_info = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .descriptorPool = streamer->mip_pool,
+                .descriptorSetCount = 1,
+                .pSetLayouts = &streamer->mip_set_layout,
+            };
+            vk_checked(vkAllocateDescriptorSets(context->logical_device, &set_info,
+                                                &texture->mip_sets[level]));
+
+            VkDescriptorImageInfo src = {
+                .sampler = streamer->sampler,
+                .imageView = texture->level_views[level - 1],
+                .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            };
+            VkDescriptorImageInfo dst = {
+                .sampler = VK_NULL_HANDLE,
+                .imageView = texture->level_views[level],
+                .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+            };
+            VkWriteDescriptorSet writes[] = {
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = texture->mip_sets[level],
+                    .dstBinding = 0,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                    .pImageInfo = &src,
+                },
+                {
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .dstSet = texture->mip_sets[level],
+                    .dstBinding = 1,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                    .pImageInfo = &dst,
+                },
+            };
+            vkUpdateDescriptorSets(context->logical_device, 2, writes, 0, NULL);
+        }
+    }
+
+    if (texture->image != VK_NULL_HANDLE)
+    {
+        assert(streamer->retired_count < MAX_RETIRED_TEXTURES && "too many retired textures");
+        streamer->retired[streamer->retired_count++] = (vk_retired_texture){
+            .image = texture->image,
+            .view = texture->view,
+            .allocation = texture->allocation,
+            .slot = texture->slot,
+            .retired_at = context->frame_number,
+        };
+        streamer->resident_bytes -= texture_level_bytes(texture, texture->resident_level);
+    }
+
+    texture->image = image;
+    texture->view = view;
+    texture->allocation = allocation;
+    texture->resident_level = top;
+    texture->slot = vk_bindless_add_image(context, view, streamer->sampler);
+    texture->loading = false;
+    streamer->resident_bytes += texture_level_bytes(texture, top);
+    request->uploaded_at = context->frame_number;
+}
+
+// Runs once a frame on the main thread, before recording: retires what the GPU is done with,
+// swaps in whatever the streaming thread has finished loading, and asks it for the next loads.
+void vk_update_textures(vk_context *context)
+{
+    vk_texture_streamer *streamer = context->textures;
+    if (streamer == NULL || streamer->texture_count == 0)
+    {
+        return;
+    }
+
+    vk_release_texture_loads(context);
+
+    pthread_mutex_lock(&streamer->mutex);
+    uint64_t loaded = streamer->loaded;
+    pthread_mutex_unlock(&streamer->mutex);
+    streamer->first_recorded = streamer->uploaded;
+    for (; streamer->uploaded < loaded; streamer->uploaded++)
+    {
+        vk_finish_texture_load(context,
+                               &streamer->requests[streamer->uploaded % MAX_TEXTURE_REQUESTS]);
+    }
+
+    vk_update_texture_budget(context);
+    vk_choose_texture_levels(context);
+
+    // Queue up loads for every texture that doesn't have what it wants, tails first (nothing is
+    // drawn textured before its tail is in), then whatever was used most recently:
+    // (only the main thread writes `submitted`, so no need to lock for reading it)
+    uint64_t submitted = streamer->submitted;
+    for (uint32_t pass = 0; pass < 2; pass++)
+    {
+        for (uint32_t i = 0; i < streamer->texture_count; i++)
+        {
+            vk_texture *texture = &streamer->textures[i];
+            bool has_tail = texture->slot != NO_TEXTURE;
+            if (texture->loading || texture->wanted_level == texture->resident_level ||
+                has_tail == (pass == 0) ||
+                submitted - streamer->released == MAX_TEXTURE_REQUESTS)
+            {
+                continue;
+            }
+            vk_texture_request *request = &streamer->requests[submitted % MAX_TEXTURE_REQUESTS];
+            request->texture = i;
+            request->top_level = texture->wanted_level;
+            texture->loading = true;
+            submitted++;
+        }
+    }
+
+    pthread_mutex_lock(&streamer->mutex);
+    if (submitted != streamer->submitted)
+    {
+        streamer->submitted = submitted;
+        pthread_cond_signal(&streamer->wake);
+    }
+    pthread_mutex_unlock(&streamer->mutex);
+}
+
+// Records building the generated levels of a texture whose level 0 was just copied in, leaving
+// the whole image ready for the fragment shader.  Expects every level to be in
+// TRANSFER_DST_OPTIMAL.
+static void vk_record_mip_generation(vk_context *context, VkCommandBuffer command_buffer,
+                                     vk_texture *texture)
+{
+    vk_texture_streamer *streamer = context->textures;
+    uint32_t level_count = texture->generated_levels + 1;
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = texture->image,
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+    };
+
+    if (!texture->generate_with_compute)
+    {
+        // every level is a linear blit of the one above, which has to be done being written first:
+        for (uint32_t level = 1; level < level_count; level++)
+        {
+            barrier.subresourceRange.baseMipLevel = level - 1;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+            VkImageBlit blit = {
+                .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1},
+                .srcOffsets = {{0, 0, 0},
+                               {(int32_t)mip_extent(texture->width, level - 1),
+                                (int32_t)mip_extent(texture->height, level - 1), 1}},
+                .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+                .dstOffsets = {{0, 0, 0},
+                               {(int32_t)mip_extent(texture->width, level),
+                                (int32_t)mip_extent(texture->height, level), 1}},
+            };
+            vkCmdBlitImage(command_buffer, texture->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                           VK_FILTER_LINEAR);
+        }
+
+        // everything but the last level has been blitted from, and the last one was just written:
+        VkImageMemoryBarrier to_shader[2] = {barrier, barrier};
+        to_shader[0].subresourceRange.baseMipLevel = 0;
+        to_shader[0].subresourceRange.levelCount = level_count - 1;
+        to_shader[0].srcAccessMask = 0;
+        to_shader[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        to_shader[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        to_shader[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        to_shader[1].subresourceRange.baseMipLevel = level_count - 1;
+        to_shader[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        to_shader[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        to_shader[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        to_shader[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 2,
+                             to_shader);
+        return;
+    }
+
+    // Compute fallback: level 0 gets read by the first dispatch (and later the fragment shader,
+    // which no other barrier covers it for), and the rest are written by the shader in GENERAL
+    // layout (what's in them now doesn't matter).
+    VkImageMemoryBarrier to_compute[2] = {barrier, barrier};
+    to_compute[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    to_compute[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    to_compute[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    to_compute[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    to_compute[1].subresourceRange.baseMipLevel = 1;
+    to_compute[1].subresourceRange.levelCount = level_count - 1;
+    to_compute[1].srcAccessMask = 0;
+    to_compute[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    to_compute[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    to_compute[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0, 0, NULL, 0, NULL, 2, to_compute);
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, streamer->mip_pipeline);
+    for (uint32_t level = 1; level < level_count; level++)
+    {
+        mip_push_constants push = {
+            .src_size = {(int32_t)mip_extent(texture->width, level - 1),
+                         (int32_t)mip_extent(texture->height, level - 1)},
+            .dst_size = {(int32_t)mip_extent(texture->width, level),
+                         (int32_t)mip_extent(texture->height, level)},
+        };
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                streamer->mip_pipeline_layout, 0, 1, &texture->mip_sets[level],
+                                0, NULL);
+        vkCmdPushConstants(command_buffer, streamer->mip_pipeline_layout,
+                           VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+        vkCmdDispatch(command_buffer,
+                      (push.dst_size[0] + MIP_WORKGROUP_SIZE - 1) / MIP_WORKGROUP_SIZE,
+                      (push.dst_size[1] + MIP_WORKGROUP_SIZE - 1) / MIP_WORKGROUP_SIZE, 1);
+
+        // the level is the next dispatch's source, and the fragment shader's eventually:
+        barrier.subresourceRange.baseMipLevel = level;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                                 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             0, 0, NULL, 0, NULL, 1, &barrier);
+    }
+}
+
+// Records the staging ring -> image copies for the loads vk_update_textures swapped in this frame.
+// Has to go before anything samples the textures.
+void vk_record_texture_uploads(vk_context *context, VkCommandBuffer command_buffer)
+{
+    vk_texture_streamer *streamer = context->textures;
+    if (streamer == NULL)
+    {
+        return;
+    }
+
+    for (uint64_t i = streamer->first_recorded; i < streamer->uploaded; i++)
+    {
+        vk_texture_request *request = &streamer->requests[i % MAX_TEXTURE_REQUESTS];
+        vk_texture *texture = &streamer->textures[request->texture];
+        uint32_t level_count = texture->level_count - request->top_level;
+        VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+                                         level_count + texture->generated_levels, 0, 1};
+
+        VkImageMemoryBarrier to_transfer = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = texture->image,
+            .subresourceRange = range,
+        };
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
+                             &to_transfer);
+
+        VkBufferImageCopy regions[KTX2_MAX_LEVELS];
+        for (uint32_t level = 0; level < level_count; level++)
+        {
+            uint32_t file_level = request->top_level + level;
+            regions[level] = (VkBufferImageCopy){
+                .bufferOffset = request->level_offsets[file_level],
+                // tightly packed:
+                .bufferRowLength = 0,
+                .bufferImageHeight = 0,
+                .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+                .imageOffset = {0, 0, 0},
+                .imageExtent = {texture->width >> file_level > 0 ? texture->width >> file_level
+                                                                 : 1,
+                                texture->height >> file_level > 0 ? texture->height >> file_level
+                                                                  : 1,
+                                1},
+            };
+        }
+        vkCmdCopyBufferToImage(command_buffer, streamer->staging_buffer, texture->image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, level_count, regions);
+        if (texture->generated_levels > 0)
+        {
+            vk_record_mip_generation(context, command_buffer, texture);
+            continue;
+        }
+
+        VkImageMemoryBarrier to_shader = to_transfer;
+        to_shader.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        to_shader.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        to_shader.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        to_shader.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1,
+                             &to_shader);
+    }
+}
+
+// Fills in the frame's texture -> bindless slot table.
+static void vk_write_texture_slots(vk_context *context, frame_uniforms *uniforms)
+{
+    vk_texture_streamer *streamer = context->textures;
+    for (uint32_t i = 0; i < MAX_TEXTURES; i++)
+    {
+        uniforms->texture_slots[i] = streamer != NULL && i < streamer->texture_count
+                                         ? streamer->textures[i].slot
+                                         : NO_TEXTURE;
+    }
+}
+
+// Stops the streaming thread.  Everything else goes away with the device.
+void vk_textures_free(vk_context *context)
+{
+    vk_texture_streamer *streamer = context->textures;
+    if (streamer == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&streamer->mutex);
+    streamer->stop = true;
+    pthread_cond_signal(&streamer->wake);
+    pthread_mutex_unlock(&streamer->mutex);
+    pthread_join(streamer->thread, NULL);
+    pthread_mutex_destroy(&streamer->mutex);
+    pthread_cond_destroy(&streamer->wake);
+
+    for (uint32_t i = 0; i < streamer->texture_count; i++)
+    {
+        munmap((void *)streamer->textures[i].file, streamer->textures[i].file_size);
+        free(streamer->textures[i].path);
+    }
+    free(streamer);
+    context->textures = NULL;
+}
+
+// Builds the scene: `count` copies of the mesh laid out on a grid, each with a gpu_object in a
+// storage buffer for the vertex shader (and culling shader) to read, plus the matching draw list
+// for the CPU-driven path.  Has to come after vk_init_textures, which decides what the objects'
+// textures are.  Until we have more than one mesh this is mostly useful for giving the
+// recording threads / culling something to chew on.
+void vk_init_scene(vk_context *context, uint32_t count)
+{
+    assert(count > 0 && "the scene needs at least one object");
+    context->draws = calloc(count, sizeof(vk_draw));
+    gpu_object *objects = calloc(count, sizeof(gpu_object));
+
+    // Make the grid half again as big as the screen so that a good chunk of it is off screen and
+    // gets culled.  A single object gets the whole screen, which is how the triangle looked before.
+    uint32_t columns = 1;
+    while (columns * columns < count)
+    {
+        columns++;
+    }
+    float extent = columns == 1 ? 1.0f : 1.5f;
+    float spacing = 2.0f * extent / columns;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        context->draws[i] = (vk_draw){
+            .index_count = context->index_count,
+            .first_index = 0,
+            .vertex_offset = 0,
+        };
+
+        float scale = spacing / 2.0f;
+        objects[i] = (gpu_object){
+            .center = {-extent + spacing * (i % columns + 0.5f),
+                       -extent + spacing * (i / columns + 0.5f)},
+            .scale = scale,
+            .radius = triangle_radius * scale,
+            .index_count = context->index_count,
+            .first_index = 0,
+            .vertex_offset = 0,
+            // spread the textures (if there are any) over the grid:
+            .texture = context->textures != NULL && context->textures->texture_count > 0
+                           ? i % context->textures->texture_count
+                           : NO_TEXTURE,
+        };
+    }
+    context->draw_count = count;
+
+    vk_create_device_buffer(context, objects, count * sizeof(gpu_object),
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &context->object_buffer,
+                            &context->object_allocation);
+    vk_upload_flush(context);
+    context->objects = objects;
+
+    // the vertex shader finds the objects through the bindless set (the culling shader binds the
+    // buffer the old fashioned way, in its own set)
+    context->object_buffer_index = vk_bindless_add_buffer(context, context->object_buffer);
+
+    // one pool for every other descriptor set we'll ever need: the uniform set, plus a culling
+    // set (of 3 storage buffers) per frame in flight
+    VkDescriptorPoolSize pool_sizes[] = {
+        {.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, .descriptorCount = 1},
+        {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 3 * MAX_FRAMES_IN_FLIGHT},
+    };
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 1 + MAX_FRAMES_IN_FLIGHT,
+        .poolSizeCount = 2,
+        .pPoolSizes = pool_sizes,
+    };
+    vk_checked(vkCreateDescriptorPool(context->logical_device, &pool_info, NULL,
+                                      &context->descriptor_pool));
+
+    dbg("successfully initialized scene with %d objects\n", count);
+}
+
+// Uniforms go through the frame arena: they're memcpy'd into this frame's region, and a single
+// UNIFORM_BUFFER_DYNAMIC descriptor covering the whole arena is pointed at them with a dynamic
+// offset when the set gets bound.  So new uniform data costs a memcpy and an offset rather than a
+// descriptor set allocation + update.  (Dynamic descriptors can't live in the update-after-bind
+// bindless set, hence set 1.)
+void vk_init_frame_uniforms(vk_context *context)
+{
+    assert(context->frame_arena.buffer != VK_NULL_HANDLE &&
+           context->descriptor_pool != VK_NULL_HANDLE &&
+           "expected the frame arena and descriptor pool to be initialized before uniforms");
+
+    VkDescriptorSetLayoutBinding binding = {
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+    };
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindings = &binding,
+    };
+    vk_checked(vkCreateDescriptorSetLayout(context->logical_device, &layout_info, NULL,
+                                           &context->uniform_set_layout));
+
+    VkDescriptorSetAllocateInfo set_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = context->descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &context->uniform_set_layout,
+    };
+    vk_checked(
+        vkAllocateDescriptorSets(context->logical_device, &set_info, &context->uniform_set));
+
+    // the range is what the shader sees at the dynamic offset, i.e. one frame_uniforms:
+    VkDescriptorBufferInfo buffer_info = {
+        .buffer = context->frame_arena.buffer,
+        .offset = 0,
+        .range = sizeof(frame_uniforms),
+    };
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = context->uniform_set,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .pBufferInfo = &buffer_info,
+    };
+    vkUpdateDescriptorSets(context->logical_device, 1, &write, 0, NULL);
+
+    dbg("successfully initialized frame uniforms\n");
+}
+
+// Copies `uniforms` into this frame's part of the arena and returns the dynamic offset to bind
+// context->uniform_set with.  Cheap enough to call per draw, although so far everything is per
+// frame.
+static uint32_t vk_push_uniforms(vk_context *context, const frame_uniforms *uniforms)
+{
+    vk_transient_alloc alloc =
+        vk_frame_alloc(context, sizeof(frame_uniforms),
+                       context->physical_device_props.limits.minUniformBufferOffsetAlignment);
+    memcpy(alloc.data, uniforms, sizeof(frame_uniforms));
+    return (uint32_t)alloc.offset;
+}
+
+// Sets up --record-threads: a worker per slice of the draw list, each with a command pool per frame
+// in flight to record secondary command buffers from.
+void vk_init_record_threads(vk_context *context, uint32_t thread_count)
+{
+    context->record_slice_count = thread_count;
+    context->record_slices = calloc(thread_count, sizeof(vk_record_slice));
+
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        // no RESET_COMMAND_BUFFER_BIT: each pool gets reset as a whole before it's recorded into
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = context->queue_indices.graphics,
+    };
+
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        vk_record_slice *slice = &context->record_slices[i];
+        for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
+        {
+            vk_checked(vkCreateCommandPool(context->logical_device, &pool_info, NULL,
+                                           &slice->pools[frame]));
+
+            VkCommandBufferAllocateInfo buffer_alloc_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = slice->pools[frame],
+                // executed from the primary command buffer with vkCmdExecuteCommands
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1,
+            };
+            vk_checked(vkAllocateCommandBuffers(context->logical_device, &buffer_alloc_info,
+                                                &slice->buffers[frame]));
+        }
+    }
+
+    context->jobs = job_pool_alloc(thread_count);
+    dbg("successfully initialized %d recording threads\n", thread_count);
+}
+
+// Binds everything the draws need.  Secondary command buffers don't inherit any state from the
+// primary, so they have to do this too.
+static void vk_bind_draw_state(vk_context *context, VkCommandBuffer command_buffer,
+                               VkPipeline pipeline)
+{
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    VkDescriptorSet sets[] = {context->bindless_set, context->uniform_set};
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            context->pipeline_layout, 0, 2, sets, 1, &context->uniform_offset);
+    draw_push_constants push_constants = {
+        .object_buffer = context->object_buffer_index,
+    };
+    vkCmdPushConstants(command_buffer, context->pipeline_layout,
+                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                       sizeof(push_constants), &push_constants);
+
+    VkViewport viewport = {
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = context->swapchain_extent.width,
+        .height = context->swapchain_extent.height,
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f,
+    };
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+
+    VkRect2D scissor = {
+        .offset = {0, 0},
+        .extent = context->swapchain_extent,
+    };
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+    VkDeviceSize vertex_offset = 0;
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, &context->vertex_buffer, &vertex_offset);
+    vkCmdBindIndexBuffer(command_buffer, context->index_buffer, 0, VK_INDEX_TYPE_UINT16);
+}
+
+// Records draws [first, first + count) of the draw list, inside the render pass.  Used for both the
+// primary command buffer and the secondaries.
+static void vk_record_draws(vk_context *context, VkCommandBuffer command_buffer, uint32_t first,
+                            uint32_t count)
+{
+    // with --depth-prepass, the same draws go in twice: depth only, then color
+    for (uint32_t pass = context->depth_prepass ? 0 : 1; pass < 2; pass++)
+    {
+        vk_bind_draw_state(context, command_buffer,
+                           pass == 0 ? context->prepass_pipeline : context->pipeline);
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            vk_draw *draw = &context->draws[i];
+            // firstInstance is how the vertex shader finds the draw's gpu_object:
+            vkCmdDrawIndexed(command_buffer, draw->index_count, 1, draw->first_index,
+                             draw->vertex_offset, i);
+        }
+    }
+}
+
+// job_fn for the recording threads: records one slice of the draw list into that slice's secondary
+// command buffer for the current frame.
+static void vk_record_slice_job(void *user_data, uint32_t slice_index)
+{
+    vk_context *context = user_data;
+    uint32_t frame = context->current_frame;
+    vk_record_slice *slice = &context->record_slices[slice_index];
+    VkCommandBuffer command_buffer = slice->buffers[frame];
+
+    // draw_frame has waited on this frame slot's fence, so the GPU is done with the pool's buffer:
+    vk_checked(vkResetCommandPool(context->logical_device, slice->pools[frame], 0));
+
+    // secondaries that run inside a render pass have to say which one (and may say which
+    // framebuffer, which lets some drivers do a better job).  With dynamic rendering they describe
+    // the attachments instead:
+    VkCommandBufferInheritanceRenderingInfo inheritance_rendering = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+        .colorAttachmentCount = 1,
+        .pColorAttachmentFormats = &context->swapchain_image_format,
+        .depthAttachmentFormat = context->depth_format,
+        .rasterizationSamples = context->msaa_samples,
+    };
+    VkCommandBufferInheritanceInfo inheritance_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = context->dynamic_rendering ? &inheritance_rendering : NULL,
+        .renderPass = context->render_pass,
+        .subpass = 0,
+        .framebuffer = context->dynamic_rendering
+                           ? VK_NULL_HANDLE
+                           : context->framebuffers[context->record_image_index],
+    };
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT |
+                 VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = &inheritance_info,
+    };
+    vk_checked(vkBeginCommandBuffer(command_buffer, &begin_info));
+
+    // split the draw list into (roughly) even slices:
+    uint32_t first = (uint64_t)context->draw_count * slice_index / context->record_slice_count;
+    uint32_t end = (uint64_t)context->draw_count * (slice_index + 1) / context->record_slice_count;
+    vk_record_draws(context, command_buffer, first, end - first);
+
+    vk_checked(vkEndCommandBuffer(command_buffer));
+}
+
+// Sets up --instances: `count` copies of the mesh drawn with a single instanced draw call, with
+// each instance's transform and color coming from a per-instance vertex stream.  The stream gets
+// rewritten every frame, so it lives in a persistently mapped buffer with a slot per frame in
+// flight (it's usually too big for the frame arena).
+void vk_init_instances(vk_context *context, uint32_t count)
+{
+    VkDeviceSize slot_size = (VkDeviceSize)count * sizeof(instance_data);
+    vk_create_buffer(context, slot_size * MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &context->instance_buffer,
+                     &context->instance_allocation);
+    context->instance_count = count;
+
+    dbg("successfully initialized %d instances (%llu bytes per frame)\n", count,
+        (unsigned long long)slot_size);
+}
+
+// Writes this frame's instance data, on the same kind of grid as vk_init_scene, with every
+// instance spinning at its own speed so that there's something to update.
+static void vk_update_instances(vk_context *context, instance_data *instances)
+{
+    uint32_t count = context->instance_count;
+    uint32_t columns = 1;
+    while (columns * columns < count)
+    {
+        columns++;
+    }
+    float spacing = 2.0f / columns;
+    // based on frame_number rather than the clock so that headless runs are reproducible:
+    float time = context->frame_number / 60.0f;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t column = i % columns;
+        uint32_t row = i / columns;
+        instances[i] = (instance_data){
+            .transform = {-1.0f + spacing * (column + 0.5f), -1.0f + spacing * (row + 0.5f),
+                          spacing / 2.0f, time * (1.0f + (i % 7) * 0.25f)},
+            .color = {(uint8_t)(255 * column / columns), (uint8_t)(255 * row / columns), 255, 255},
+        };
+    }
+}
+
+// Draws all of the instances in one go, inside the render pass.
+static void vk_record_instanced_draw(vk_context *context, VkCommandBuffer command_buffer)
+{
+    // draw_frame has waited on this frame's fence, so the GPU is done reading this slot:
+    VkDeviceSize slot_offset =
+        context->current_frame * (VkDeviceSize)context->instance_count * sizeof(instance_data);
+    vk_update_instances(context,
+                        (instance_data *)((char *)context->instance_allocation.mapped +
+                                          slot_offset));
+
+    for (uint32_t pass = context->depth_prepass ? 0 : 1; pass < 2; pass++)
+    {
+        vk_bind_draw_state(context, command_buffer,
+                           pass == 0 ? context->instanced_prepass_pipeline
+                                     : context->instanced_pipeline);
+        vkCmdBindVertexBuffers(command_buffer, 1, 1, &context->instance_buffer, &slot_offset);
+        vkCmdDrawIndexed(command_buffer, context->index_count, context->instance_count, 0, 0, 0);
+    }
+}
+
+// Creates the culling compute pipeline.  Like vk_create_graphics_pipelines, safe to call from the
+// hot reloader's thread.
+static void vk_create_cull_pipeline(vk_context *context, VkPipeline *pipeline_out)
+{
+    shader_code cull_shader = vk_load_shader(context, "cull.comp", VK_SHADER_STAGE_COMPUTE_BIT);
+    VkShaderModule cull_mod = create_shader_module(context, &cull_shader);
+    VkComputePipelineCreateInfo pipeline_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage =
+            (VkPipelineShaderStageCreateInfo){
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                .module = cull_mod,
+                .pName = cull_shader.entry_point,
+            },
+        .layout = context->cull_pipeline_layout,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1,
+    };
+    vk_checked(vkCreateComputePipelines(context->logical_device, context->pipeline_cache, 1,
+                                        &pipeline_info, NULL, pipeline_out));
+    vkDestroyShaderModule(context->logical_device, cull_mod, NULL);
+    release_shader_code(&cull_shader);
+}
+
+// Sets up --gpu-cull: a compute pass that frustum culls every object against the view and writes
+// the draws for the visible ones into an indirect buffer, so that recording a frame costs the
+// same no matter how many objects there are.
+void vk_init_gpu_culling(vk_context *context)
+{
+    assert(context->object_buffer != VK_NULL_HANDLE &&
+           "expected the scene to be initialized before gpu culling");
+
+    // objects in, draw commands + draw count out:
+    VkDescriptorSetLayoutBinding bindings[3];
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        bindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+    }
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 3,
+        .pBindings = bindings,
+    };
+    vk_checked(vkCreateDescriptorSetLayout(context->logical_device, &layout_info, NULL,
+                                           &context->cull_set_layout));
+
+    VkPushConstantRange push_constant_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(cull_push_constants),
+    };
+    VkPipelineLayoutCreateInfo pipeline_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &context->cull_set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_constant_range,
+    };
+    vk_checked(vkCreatePipelineLayout(context->logical_device, &pipeline_layout_info, NULL,
+                                      &context->cull_pipeline_layout));
+
+    // (the pipeline itself is one of the startup builds)
+
+    // the count a compacting cull writes has to stay under maxDrawIndirectCount, and it can't be
+    // split into batches after the fact, so bigger scenes go back to the plain indirect draws
+    // (which vk_record_indirect_draws splits up instead):
+    if (context->draw_indirect_count &&
+        context->draw_count > context->physical_device_props.limits.maxDrawIndirectCount)
+    {
+        dbg("%u objects is more than maxDrawIndirectCount (%u), not compacting\n",
+            context->draw_count, context->physical_device_props.limits.maxDrawIndirectCount);
+        context->draw_indirect_count = false;
+    }
+
+    // the culling pass for one frame can run while the GPU is still drawing the previous one, so
+    // every frame in flight gets its own output buffers:
+    VkDeviceSize commands_size = context->draw_count * sizeof(VkDrawIndexedIndirectCommand);
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        vk_create_buffer(context, commands_size,
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &context->indirect_buffers[i],
+                         &context->indirect_allocations[i]);
+        // (cleared with vkCmdFillBuffer at the start of every culling pass)
+        vk_create_buffer(context, sizeof(uint32_t),
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                             VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &context->draw_count_buffers[i],
+                         &context->draw_count_allocations[i]);
+
+        VkDescriptorSetAllocateInfo set_info = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = context->descriptor_pool,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &context->cull_set_layout,
+        };
+        vk_checked(
+            vkAllocateDescriptorSets(context->logical_device, &set_info, &context->cull_sets[i]));
+
+        VkDescriptorBufferInfo buffer_infos[] = {
+            {.buffer = context->object_buffer, .offset = 0, .range = VK_WHOLE_SIZE},
+            {.buffer = context->indirect_buffers[i], .offset = 0, .range = VK_WHOLE_SIZE},
+            {.buffer = context->draw_count_buffers[i], .offset = 0, .range = VK_WHOLE_SIZE},
+        };
+        VkWriteDescriptorSet write = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = context->cull_sets[i],
+            .dstBinding = 0,
+            // consecutive bindings of the same type can be written in one go:
+            .descriptorCount = 3,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = buffer_infos,
+        };
+        vkUpdateDescriptorSets(context->logical_device, 1, &write, 0, NULL);
+    }
+
+    context->gpu_cull = true;
+    dbg("successfully initialized gpu culling (%s)\n",
+        context->draw_indirect_count ? "vkCmdDrawIndexedIndirectCount"
+                                     : "vkCmdDrawIndexedIndirect fallback");
+}
+
+// Startup pipeline builds: every pipeline we might want is gathered up front and compiled on a
+// pool of worker threads, all sharing context->pipeline_cache (vkCreate*Pipelines synchronizes
+// access to the cache itself).  The main thread only waits for the ones it's about to draw with,
+// and the rest finish in the background while the first frames are already going.
+
+// vk_pipeline_build::features for the culling pipeline rather than a graphics permutation:
+#define PIPELINE_BUILD_CULL UINT32_MAX
+#define MAX_PIPELINE_BUILDS (PIPELINE_VARIANT_COUNT + 1)
+
+typedef struct vk_pipeline_build
+{
+    // pipeline_feature bits, or PIPELINE_BUILD_CULL
+    uint32_t features;
+    bool done;
+} vk_pipeline_build;
+
+typedef struct vk_pipeline_builder
+{
+    vk_context *context;
+    job_pool *pool;
+    uint64_t start_ns;
+    uint64_t finish_ns;
+    // guards builds[].done, remaining, finish_ns and the context fields the builds write
+    // (pipeline_variants and cull_pipeline)
+    pthread_mutex_t mutex;
+    pthread_cond_t built;
+    uint32_t remaining;
+    uint32_t build_count;
+    vk_pipeline_build builds[MAX_PIPELINE_BUILDS];
+} vk_pipeline_builder;
+
+static void vk_pipeline_build_job(void *user_data, uint32_t job_index)
+{
+    vk_pipeline_builder *builder = user_data;
+    vk_context *context = builder->context;
+    vk_pipeline_build *build = &builder->builds[job_index];
+
+    vk_pipeline_variant variant = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
+    VkPipeline cull_pipeline = VK_NULL_HANDLE;
+    if (build->features == PIPELINE_BUILD_CULL)
+    {
+        vk_create_cull_pipeline(context, &cull_pipeline);
+    }
+    else
+    {
+        vk_create_graphics_pipelines(context, build->features, &variant);
+    }
+
+    pthread_mutex_lock(&builder->mutex);
+    if (build->features == PIPELINE_BUILD_CULL)
+    {
+        context->cull_pipeline = cull_pipeline;
+    }
+    else
+    {
+        context->pipeline_variants[build->features] = variant;
+    }
+    build->done = true;
+    if (--builder->remaining == 0)
+    {
+        builder->finish_ns = now_ns();
+    }
+    pthread_cond_broadcast(&builder->built);
+    pthread_mutex_unlock(&builder->mutex);
+}
+
+// Queues up every pipeline this run could use and starts compiling them.  Needs the pipeline
+// layouts (and the culling one, with --gpu-cull) to exist already.
+void vk_start_pipeline_builds(vk_context *context)
+{
+    assert(context->pipeline_layout != VK_NULL_HANDLE &&
+           "expected the graphics pipeline layout to exist before building pipelines");
+
+    vk_pipeline_builder *builder = calloc(1, sizeof(vk_pipeline_builder));
+    builder->context = context;
+    builder->start_ns = now_ns();
+    pthread_mutex_init(&builder->mutex, NULL);
+    pthread_cond_init(&builder->built, NULL);
+
+    // what the first frame needs goes first, so those are what the workers pick up first:
+    uint32_t active = context->pipeline_features;
+    builder->builds[builder->build_count++] = (vk_pipeline_build){.features = active};
+    if (context->cull_pipeline_layout != VK_NULL_HANDLE)
+    {
+        builder->builds[builder->build_count++] =
+            (vk_pipeline_build){.features = PIPELINE_BUILD_CULL};
+    }
+
+    // ENCODE_SRGB is decided by the swapchain format, so only the permutations that agree with the
+    // active one on it can ever be switched to:
+    for (uint32_t features = 0; features < PIPELINE_VARIANT_COUNT; features++)
+    {
+        if (features != active &&
+            (features & PIPELINE_FEATURE_ENCODE_SRGB) == (active & PIPELINE_FEATURE_ENCODE_SRGB))
+        {
+            builder->builds[builder->build_count++] = (vk_pipeline_build){.features = features};
+        }
+    }
+    builder->remaining = builder->build_count;
+
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t thread_count = cpu_count > 0 ? (uint32_t)cpu_count : 1;
+    thread_count = thread_count > MAX_WORKER_THREADS ? MAX_WORKER_THREADS : thread_count;
+    thread_count = thread_count > builder->build_count ? builder->build_count : thread_count;
+
+    builder->pool = job_pool_alloc(thread_count);
+    context->pipeline_builder = builder;
+    job_pool_start(builder->pool, vk_pipeline_build_job, builder, builder->build_count);
+    dbg("building %u pipelines on %u threads\n", builder->build_count, thread_count);
+}
+
+// Blocks until the startup build of `features` (a pipeline_feature set, or PIPELINE_BUILD_CULL)
+// is done.  Returns false if it was never queued, or the startup builds are already over.
+static bool vk_wait_for_pipeline_build(vk_context *context, uint32_t features)
+{
+    vk_pipeline_builder *builder = context->pipeline_builder;
+    if (builder == NULL)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < builder->build_count; i++)
+    {
+        vk_pipeline_build *build = &builder->builds[i];
+        if (build->features != features)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&builder->mutex);
+        while (!build->done)
+        {
+            pthread_cond_wait(&builder->built, &builder->mutex);
+        }
+        pthread_mutex_unlock(&builder->mutex);
+        return true;
+    }
+    return false;
+}
+
+// Shuts the build threads down once the startup builds are all done (or, with `wait`, waits for
+// that first).  Called at the start of every frame until it happens.
+static void vk_finish_pipeline_builds(vk_context *context, bool wait)
+{
+    vk_pipeline_builder *builder = context->pipeline_builder;
+    if (builder == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&builder->mutex);
+    bool done = builder->remaining == 0;
+    pthread_mutex_unlock(&builder->mutex);
+    if (!done && !wait)
+    {
+        return;
+    }
+
+    job_pool_wait(builder->pool);
+    job_pool_free(builder->pool);
+    dbg("built %u pipelines in %.2fms\n", builder->build_count,
+        (builder->finish_ns - builder->start_ns) / 1e6);
+
+    pthread_mutex_destroy(&builder->mutex);
+    pthread_cond_destroy(&builder->built);
+    free(builder);
+    context->pipeline_builder = NULL;
+}
+
+// Switches to the pipeline permutation for `features`.  If it isn't one of the startup builds (or
+// hot reloading threw it away) it gets built here, through the pipeline cache.  Frames still in
+// flight keep using the old one, which stays in pipeline_variants, so this only has to be called
+// between frames.
+void vk_use_pipeline_features(vk_context *context, uint32_t features)
+{
+    assert(features < PIPELINE_VARIANT_COUNT && "unknown pipeline feature bits");
+    // if it's still being built at startup, wait for that rather than building it twice:
+    vk_wait_for_pipeline_build(context, features);
+
+    vk_pipeline_variant *variant = &context->pipeline_variants[features];
+    if (variant->pipeline == VK_NULL_HANDLE)
+    {
+        uint64_t start = now_ns();
+        vk_create_graphics_pipelines(context, features, variant);
+        dbg("built pipeline variant 0x%x in %.2fms\n", features, (now_ns() - start) / 1e6);
+    }
+
+    // the hot reloader reads this from its own thread to know which variant to rebuild:
+    __atomic_store_n(&context->pipeline_features, features, __ATOMIC_RELAXED);
+    context->pipeline = variant->pipeline;
+    context->instanced_pipeline = variant->instanced_pipeline;
+    context->prepass_pipeline = variant->prepass_pipeline;
+    context->instanced_prepass_pipeline = variant->instanced_prepass_pipeline;
+}
+
+// Records the culling dispatch for the current frame.  Has to go outside the render pass.
+static void vk_record_culling(vk_context *context, VkCommandBuffer command_buffer)
+{
+    uint32_t frame = context->current_frame;
+
+    if (context->draw_indirect_count)
+    {
+        vkCmdFillBuffer(command_buffer, context->draw_count_buffers[frame], 0, sizeof(uint32_t),
+                        0);
+        VkMemoryBarrier clear_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        };
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clear_barrier, 0, NULL,
+                             0, NULL);
+    }
+
+    // the view "frustum" is the part of the world the camera has in the clip space square:
+    float half_extent = 1.0f / context->camera_zoom;
+    cull_push_constants push_constants = {
+        .bounds_min = {context->camera_center[0] - half_extent,
+                       context->camera_center[1] - half_extent},
+        .bounds_max = {context->camera_center[0] + half_extent,
+                       context->camera_center[1] + half_extent},
+        .object_count = context->draw_count,
+        .compact = context->draw_indirect_count,
+    };
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, context->cull_pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            context->cull_pipeline_layout, 0, 1, &context->cull_sets[frame], 0,
+                            NULL);
+    vkCmdPushConstants(command_buffer, context->cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(push_constants), &push_constants);
+    vkCmdDispatch(command_buffer,
+                  (context->draw_count + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+
+    VkMemoryBarrier cull_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+    };
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &cull_barrier, 0, NULL, 0,
+                         NULL);
+}
+
+// Draws whatever survived vk_record_culling, inside the render pass.
+static void vk_record_indirect_draws(vk_context *context, VkCommandBuffer command_buffer)
+{
+    uint32_t frame = context->current_frame;
+    for (uint32_t pass = context->depth_prepass ? 0 : 1; pass < 2; pass++)
+    {
+        vk_bind_draw_state(context, command_buffer,
+                           pass == 0 ? context->prepass_pipeline : context->pipeline);
+
+        if (context->draw_indirect_count)
+        {
+            vkCmdDrawIndexedIndirectCount(command_buffer, context->indirect_buffers[frame], 0,
+                                          context->draw_count_buffers[frame], 0,
+                                          context->draw_count,
+                                          sizeof(VkDrawIndexedIndirectCommand));
+        }
+        else
+        {
+            uint32_t batch = context->physical_device_props.limits.maxDrawIndirectCount;
+            for (uint32_t first = 0; first < context->draw_count; first += batch)
+            {
+                vkCmdDrawIndexedIndirect(command_buffer, context->indirect_buffers[frame],
+                                         first * sizeof(VkDrawIndexedIndirectCommand),
+                                         min_u32(batch, context->draw_count - first),
+                                         sizeof(VkDrawIndexedIndirectCommand));
+            }
+        }
+    }
+}
+
+// Starts rendering to swapchain image `image_index`: either vkCmdBeginRendering (after moving the
+// image into COLOR_ATTACHMENT_OPTIMAL ourselves), or the render pass + framebuffer on devices
+// without dynamic rendering / with --render-pass.  `contents` says whether the draws come inline
+// or from secondary command buffers.
+static void vk_begin_rendering(vk_context *context, VkCommandBuffer command_buffer,
+                               uint32_t image_index, VkSubpassContents contents)
+{
+    VkClearValue clear_color = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+    // reverse-Z, so "infinitely far away" is 0:
+    VkClearValue clear_depth = {.depthStencil = {0.0f, 0}};
+    VkRect2D render_area = {
+        .extent = context->swapchain_extent,
+        .offset = {0, 0},
+    };
+
+    if (!context->dynamic_rendering)
+    {
+        VkClearValue clear_values[] = {clear_color, clear_depth};
+        VkRenderPassBeginInfo render_pass_info = {
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .renderPass = context->render_pass,
+            .framebuffer = context->framebuffers[image_index],
+            .renderArea = render_area,
+            .clearValueCount = 2,
+            .pClearValues = clear_values,
+        };
+        vkCmdBeginRenderPass(command_buffer, &render_pass_info, contents);
+        return;
+    }
+
+    // What the render pass' initialLayout + first subpass dependency used to do.  We don't care
+    // about the old contents (we clear them), and waiting on COLOR_ATTACHMENT_OUTPUT chains this
+    // onto the image-available semaphore wait, which happens at that same stage:
+    VkImageMemoryBarrier2 to_attachment = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .srcAccessMask = VK_ACCESS_2_NONE,
+        .dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = context->swapchain_images[image_index],
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+    };
+    // The depth buffer gets cleared too, but the previous frame that rendered to this image may
+    // still be depth testing against it (its clear and early-Z writes happen in the early tests):
+    VkImageMemoryBarrier2 depth_to_attachment = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                        VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+        .srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                        VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+        .dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                         VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = context->depth_images[image_index],
+        .subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1},
+    };
+    // With MSAA we draw to the multisampled image and the swapchain image only gets the resolve,
+    // which also happens in COLOR_ATTACHMENT_OUTPUT:
+    VkImageMemoryBarrier2 msaa_to_attachment = to_attachment;
+    if (context->msaa_images != NULL)
+    {
+        msaa_to_attachment.image = context->msaa_images[image_index];
+    }
+    VkImageMemoryBarrier2 barriers[] = {to_attachment, depth_to_attachment, msaa_to_attachment};
+    VkDependencyInfo dependency = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = context->msaa_images != NULL ? 3 : 2,
+        .pImageMemoryBarriers = barriers,
+    };
+    vkCmdPipelineBarrier2(command_buffer, &dependency);
+
+    VkRenderingAttachmentInfo color_attachment = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = context->image_views[image_index],
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .resolveMode = VK_RESOLVE_MODE_NONE,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .clearValue = clear_color,
+    };
+    if (context->msaa_views != NULL)
+    {
+        // render multisampled, average the samples into the swapchain image at the end, and never
+        // store the samples themselves:
+        color_attachment.imageView = context->msaa_views[image_index];
+        color_attachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+        color_attachment.resolveImageView = context->image_views[image_index];
+        color_attachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    }
+    VkRenderingAttachmentInfo depth_attachment = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = context->depth_views[image_index],
+        .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        .resolveMode = VK_RESOLVE_MODE_NONE,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .clearValue = clear_depth,
+    };
+    VkRenderingInfo rendering_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+        .flags = contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                     ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT
+                     : 0,
+        .renderArea = render_area,
+        .layerCount = 1,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &color_attachment,
+        .pDepthAttachment = &depth_attachment,
+    };
+    vkCmdBeginRendering(command_buffer, &rendering_info);
+}
+
+static void vk_end_rendering(vk_context *context, VkCommandBuffer command_buffer,
+                             uint32_t image_index)
+{
+    if (!context->dynamic_rendering)
+    {
+        vkCmdEndRenderPass(command_buffer);
+        return;
+    }
+    vkCmdEndRendering(command_buffer);
+
+    // ...and what the render pass' finalLayout (+ the headless dependency) used to do: hand the
+    // image to the presentation engine (which waits on a semaphore, so no stage to wait for here),
+    // or to the readback copy in headless mode:
+    VkImageMemoryBarrier2 to_consumer = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstStageMask = context->headless ? VK_PIPELINE_STAGE_2_COPY_BIT : VK_PIPELINE_STAGE_2_NONE,
+        .dstAccessMask = context->headless ? VK_ACCESS_2_TRANSFER_READ_BIT : VK_ACCESS_2_NONE,
+        .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .newLayout = context->headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                       : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = context->swapchain_images[image_index],
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+    };
+    VkDependencyInfo dependency = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = &to_consumer,
+    };
+    vkCmdPipelineBarrier2(command_buffer, &dependency);
+}
+
+void vk_record_command_buffer(vk_context *context, VkCommandBuffer command_buffer,
+                              uint32_t image_index)
+{
+    // this frame's uniforms have to be in place before anything (including the workers) binds
+    // them:
+    vk_update_textures(context);
+    frame_uniforms uniforms = {
+        .camera_center = {context->camera_center[0], context->camera_center[1]},
+        .camera_zoom = context->camera_zoom,
+        .time = context->frame_number / 60.0f,
+    };
+    vk_write_texture_slots(context, &uniforms);
+    context->uniform_offset = vk_push_uniforms(context, &uniforms);
+
+    // get the workers going on the draws first, so they run while we record everything else:
+    if (context->jobs != NULL)
+    {
+        context->record_image_index = image_index;
+        job_pool_start(context->jobs, vk_record_slice_job, context, context->record_slice_count);
+    }
+
+    // we re-record every frame, so each recording is only ever submitted once (for both reset
+    // modes, so that --cmd-reset compare only measures the difference in resetting)
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = NULL,
+    };
+
+    vk_checked(vkBeginCommandBuffer(command_buffer, &begin_info));
+
+    // take ownership of anything the transfer queue uploaded since the last frame:
+    vk_upload_acquire(context, command_buffer);
+    vk_record_texture_uploads(context, command_buffer);
+
+    // queries have to be reset before they can be written again, and outside of a render pass:
+    uint32_t first_query = context->current_frame * GPU_PASS_COUNT * 2;
+    if (context->timestamp_pool != VK_NULL_HANDLE)
+    {
+        vkCmdResetQueryPool(command_buffer, context->timestamp_pool, first_query,
+                            GPU_PASS_COUNT * 2);
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            context->timestamp_pool, first_query + GPU_PASS_CULL * 2);
+    }
+
+    if (context->gpu_cull && context->instance_count == 0)
+    {
+        vk_record_culling(context, command_buffer);
+    }
+
+    // the cull pass ends (and the main one starts) once the dispatch is done, so the two don't
+    // overlap:
+    if (context->timestamp_pool != VK_NULL_HANDLE)
+    {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            context->timestamp_pool, first_query + GPU_PASS_CULL * 2 + 1);
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            context->timestamp_pool, first_query + GPU_PASS_MAIN * 2);
+    }
+
+    if (context->jobs != NULL)
+    {
+        // a subpass is either all inline commands or all secondary command buffers:
+        vk_begin_rendering(context, command_buffer, image_index,
+                           VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+        VkCommandBuffer secondaries[MAX_WORKER_THREADS];
+        for (uint32_t i = 0; i < context->record_slice_count; i++)
+        {
+            secondaries[i] = context->record_slices[i].buffers[context->current_frame];
+        }
+        job_pool_wait(context->jobs);
+        vkCmdExecuteCommands(command_buffer, context->record_slice_count, secondaries);
+    }
+    else if (context->instance_count > 0)
+    {
+        vk_begin_rendering(context, command_buffer, image_index, VK_SUBPASS_CONTENTS_INLINE);
+        vk_record_instanced_draw(context, command_buffer);
+    }
+    else if (context->gpu_cull)
+    {
+        vk_begin_rendering(context, command_buffer, image_index, VK_SUBPASS_CONTENTS_INLINE);
+        vk_record_indirect_draws(context, command_buffer);
+    }
+    else
+    {
+        vk_begin_rendering(context, command_buffer, image_index, VK_SUBPASS_CONTENTS_INLINE);
+        vk_record_draws(context, command_buffer, 0, context->draw_count);
+    }
+    vk_end_rendering(context, command_buffer, image_index);
+
+    if (context->timestamp_pool != VK_NULL_HANDLE)
+    {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            context->timestamp_pool, first_query + GPU_PASS_MAIN * 2 + 1);
+    }
+
+    if (context->headless)
+    {
+        // copy the finished frame (already in TRANSFER_SRC_OPTIMAL thanks to vk_end_rendering)
+        // into this image's readback buffer:
+        VkBufferImageCopy region = {
+            .bufferOffset = 0,
+            // 0 = tightly packed
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource =
+                (VkImageSubresourceLayers){
+                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                    .mipLevel = 0,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {context->swapchain_extent.width, context->swapchain_extent.height, 1},
+        };
+        vkCmdCopyImageToBuffer(command_buffer, context->swapchain_images[image_index],
+                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               context->readback_buffers[image_index], 1, &region);
+
+        // and make the copy visible to the host once the fence for this frame signals:
+        VkMemoryBarrier host_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+        };
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &host_barrier, 0, NULL, 0, NULL);
+    }
+
+    vk_checked(vkEndCommandBuffer(command_buffer));
+}
+
+// One render finished semaphore per swapchain image (see vk_context::sem_render_finished):
+static void vk_init_render_finished_semaphores(vk_context *context)
+{
+    VkSemaphoreCreateInfo sem_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    };
+    context->sem_render_finished = calloc(context->swapchain_image_count, sizeof(VkSemaphore));
+    for (uint32_t i = 0; i < context->swapchain_image_count; i++)
+    {
+        vk_checked(vkCreateSemaphore(context->logical_device, &sem_info, NULL,
+                                     &context->sem_render_finished[i]));
+    }
+}
+
+void vk_init_sync(vk_context *context)
+{
+    VkSemaphoreCreateInfo sem_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    };
+
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        // Start in the signaled state so the first draw_frame call isn't waiting
+        .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+    };
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        vk_checked(vkCreateSemaphore(context->logical_device, &sem_info, NULL,
+                                     &context->sem_image_available[i]));
+        vk_checked(vkCreateFence(context->logical_device, &fence_info, NULL,
+                                 &context->fences_in_flight[i]));
+    }
+
+    // (nothing gets presented in headless mode)
+    if (!context->headless)
+    {
+        vk_init_render_finished_semaphores(context);
+    }
+
+    // no swapchain image is in use by any frame yet:
+    context->images_in_flight = calloc(context->swapchain_image_count, sizeof(VkFence));
+
+    dbg("successfully initialized semaphores and fences\n");
+}
+
+bench_stats *bench_stats_alloc(uint32_t frame_count)
+{
+    bench_stats *stats = malloc(sizeof(bench_stats));
+    for (uint32_t i = 0; i < PHASE_COUNT; i++)
+    {
+        stats->cpu[i] = (bench_series){
+            .count = 0, .cap = frame_count, .samples_ms = calloc(frame_count, sizeof(double))};
+    }
+    for (uint32_t i = 0; i < GPU_PASS_COUNT; i++)
+    {
+        stats->gpu[i] = (bench_series){
+            .count = 0, .cap = frame_count, .samples_ms = calloc(frame_count, sizeof(double))};
+    }
+    stats->last_frame_start_ns = 0;
+    return stats;
+}
+
+static void bench_series_push(bench_series *series, double sample_ms)
+{
+    // samples past the capacity come from frames that were already in flight when the run ended
+    if (series->count < series->cap)
+    {
+        series->samples_ms[series->count++] = sample_ms;
+    }
+}
+
+static void bench_push_ns(bench_stats *stats, frame_phase phase, uint64_t start, uint64_t end)
+{
+    bench_series_push(&stats->cpu[phase], (double)(end - start) / 1e6);
+}
+
+// Creates the query pool the GPU writes per-pass timestamps into (2 per pass per frame in flight).
+// Leaves context->timestamp_pool as VK_NULL_HANDLE if the graphics queue can't do timestamps.
+void vk_init_timestamp_queries(vk_context *context)
+{
+    uint32_t queue_count;
+    vkGetPhysicalDeviceQueueFamilyProperties(context->physical_device, &queue_count, NULL);
+    VkQueueFamilyProperties queue_fams[queue_count];
+    vkGetPhysicalDeviceQueueFamilyProperties(context->physical_device, &queue_count, queue_fams);
+
+    VkPhysicalDeviceLimits *limits = &context->physical_device_props.limits;
+    if (queue_fams[context->queue_indices.graphics].timestampValidBits == 0 ||
+        limits->timestampPeriod == 0.0f)
+    {
+        dbg("graphics queue does not support timestamps, GPU times will not be reported\n");
+        return;
+    }
+
+    VkQueryPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = MAX_FRAMES_IN_FLIGHT * GPU_PASS_COUNT * 2,
+    };
+    vk_checked(
+        vkCreateQueryPool(context->logical_device, &pool_info, NULL, &context->timestamp_pool));
+    context->timestamp_period = limits->timestampPeriod;
+    uint32_t valid_bits = queue_fams[context->queue_indices.graphics].timestampValidBits;
+    context->timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+    dbg("successfully initialized timestamp query pool\n");
+}
+
+// Reads back the timestamps written by the last frame that ran in slot `frame`.  The caller has to
+// have waited on that frame's fence.
+static void vk_collect_timestamps(vk_context *context, uint32_t frame)
+{
+    if (!context->timestamps_pending[frame])
+    {
+        return;
+    }
+    context->timestamps_pending[frame] = false;
+
+    uint64_t timestamps[GPU_PASS_COUNT * 2];
+    VkResult result = vkGetQueryPoolResults(
+        context->logical_device, context->timestamp_pool, frame * GPU_PASS_COUNT * 2,
+        GPU_PASS_COUNT * 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS || context->bench == NULL)
+    {
+        return;
+    }
+
+    for (uint32_t pass = 0; pass < GPU_PASS_COUNT; pass++)
+    {
+        uint64_t ticks = ((timestamps[pass * 2 + 1] & context->timestamp_mask) -
+                          (timestamps[pass * 2] & context->timestamp_mask)) &
+                         context->timestamp_mask;
+        bench_series_push(&context->bench->gpu[pass],
+                          (double)ticks * context->timestamp_period / 1e6);
+    }
+}
+
+#ifdef SHADER_HOT_RELOAD
+// Shader hot reloading (`make HOT_RELOAD=1`, needs libshaderc): a thread watches the shaders
+// directory with inotify, recompiles GLSL files when they change, and builds a new set of
+// pipelines from them in the background (through the pipeline cache, so unchanged stages are
+// cheap).  draw_frame swaps the new set in at the start of a frame, and the old one is destroyed
+// once no frame in flight can still be using it.
+
+#define SHADER_DIR "shaders"
+
+static bool shader_kind_from_name(const char *name, shaderc_shader_kind *kind)
+{
+    const char *ext = strrchr(name, '.');
+    if (ext == NULL)
+    {
+        return false;
+    }
+
+    if (strcmp(ext, ".vert") == 0)
+    {
+        *kind = shaderc_vertex_shader;
+    }
+    else if (strcmp(ext, ".frag") == 0)
+    {
+        *kind = shaderc_fragment_shader;
+    }
+    else if (strcmp(ext, ".comp") == 0)
+    {
+        *kind = shaderc_compute_shader;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Compiles SHADER_DIR/<name> into SHADER_DIR/<name>.spv, the same as the Makefile's glslc rule.
+// Returns false (after printing the errors) if it doesn't compile.
+static bool hot_reload_compile(shader_hot_reload *reload, const char *name,
+                               shaderc_shader_kind kind)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", SHADER_DIR, name);
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        dbg("could not open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long source_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *source = malloc(source_size > 0 ? source_size : 1);
+    size_t read_size = fread(source, 1, source_size, file);
+    fclose(file);
+
+    shaderc_compilation_result_t result = shaderc_compile_into_spv(
+        reload->compiler, source, read_size, kind, path, "main", NULL);
+    free(source);
+
+    bool ok = shaderc_result_get_compilation_status(result) == shaderc_compilation_status_success;
+    if (!ok)
+    {
+        dbg("failed to compile %s:\n%s", path, shaderc_result_get_error_message(result));
+    }
+    else
+    {
+        // write to a temporary file and rename it over the old one, so nothing ever sees a half
+        // written .spv:
+        char spv_path[4096 + 8];
+        char tmp_path[4096 + 16];
+        snprintf(spv_path, sizeof(spv_path), "%s.spv", path);
+        snprintf(tmp_path, sizeof(tmp_path), "%s.spv.tmp", path);
+
+        FILE *out = fopen(tmp_path, "wb");
+        ok = out != NULL && fwrite(shaderc_result_get_bytes(result), 1,
+                                   shaderc_result_get_length(result),
+                                   out) == shaderc_result_get_length(result);
+        if (out != NULL)
+        {
+            ok = fclose(out) == 0 && ok;
+        }
+        ok = ok && rename(tmp_path, spv_path) == 0;
+        if (!ok)
+        {
+            dbg("could not write %s: %s\n", spv_path, strerror(errno));
+        }
+    }
+
+    shaderc_result_release(result);
+    return ok;
+}
+
+static void vk_destroy_pipeline_set(vk_context *context, vk_pipeline_set *set)
+{
+    // (vkDestroyPipeline ignores VK_NULL_HANDLE, so unused pipelines are fine)
+    for (uint32_t i = 0; i < PIPELINE_VARIANT_COUNT; i++)
+    {
+        vkDestroyPipeline(context->logical_device, set->variants[i].pipeline, NULL);
+        vkDestroyPipeline(context->logical_device, set->variants[i].instanced_pipeline, NULL);
+        vkDestroyPipeline(context->logical_device, set->variants[i].prepass_pipeline, NULL);
+        vkDestroyPipeline(context->logical_device, set->variants[i].instanced_prepass_pipeline,
+                          NULL);
+    }
+    vkDestroyPipeline(context->logical_device, set->cull_pipeline, NULL);
+}
+
+static void *hot_reload_thread(void *arg)
+{
+    vk_context *context = arg;
+    shader_hot_reload *reload = context->hot_reload;
+    // inotify events are variable length (the file name is tacked onto the end), so read them into
+    // a buffer aligned for the struct:
+    alignas(struct inotify_event) char events[4096];
+
+    for (;;)
+    {
+        // wake up every now and then to check whether we should stop:
+        struct pollfd poll_fd = {.fd = reload->inotify_fd, .events = POLLIN};
+        int ready = poll(&poll_fd, 1, 100);
+
+        pthread_mutex_lock(&reload->mutex);
+        bool stop = reload->stop;
+        pthread_mutex_unlock(&reload->mutex);
+        if (stop)
+        {
+            break;
+        }
+
+        ssize_t length = ready > 0 ? read(reload->inotify_fd, events, sizeof(events)) : 0;
+        if (length <= 0)
+        {
+            continue;
+        }
+
+        // Editors tend to save in several steps, so compile everything that changed in this batch
+        // and rebuild once.  If anything fails to compile, keep the old pipelines.
+        bool changed = false;
+        bool failed = false;
+        for (char *ptr = events; ptr < events + length;)
+        {
+            struct inotify_event *event = (struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            shaderc_shader_kind kind;
+            if (event->len == 0 || !shader_kind_from_name(event->name, &kind))
+            {
+                continue;
+            }
+
+            dbg("shader %s changed, recompiling\n", event->name);
+            if (hot_reload_compile(reload, event->name, kind))
+            {
+                changed = true;
+            }
+            else
+            {
+                failed = true;
+            }
+        }
+        if (!changed || failed)
+        {
+            continue;
+        }
+
+        // only rebuild the permutation we're drawing with; the others get built again if they're
+        // switched to
+        uint32_t features = __atomic_load_n(&context->pipeline_features, __ATOMIC_RELAXED);
+        vk_pipeline_set set = {0};
+        vk_create_graphics_pipelines(context, features, &set.variants[features]);
+        if (context->cull_pipeline_layout != VK_NULL_HANDLE)
+        {
+            vk_create_cull_pipeline(context, &set.cull_pipeline);
+        }
+
+        pthread_mutex_lock(&reload->mutex);
+        // if the last set we built still hasn't been picked up, it was never used, so it can go
+        // right away:
+        if (reload->pending)
+        {
+            vk_destroy_pipeline_set(context, &reload->pending_set);
+        }
+        reload->pending_set = set;
+        reload->pending = true;
+        pthread_mutex_unlock(&reload->mutex);
+        dbg("rebuilt pipelines, swapping them in at the next frame\n");
+    }
+
+    return NULL;
+}
+
+void vk_init_shader_hot_reload(vk_context *context)
+{
+    shader_hot_reload *reload = calloc(1, sizeof(shader_hot_reload));
+    reload->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (reload->inotify_fd < 0)
+    {
+        dbg("could not initialize inotify: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    // editors either write files in place or write a temporary file and rename it over the
+    // original, so watch for both:
+    if (inotify_add_watch(reload->inotify_fd, SHADER_DIR, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        dbg("could not watch %s: %s\n", SHADER_DIR, strerror(errno));
+        exit(1);
+    }
+
+    reload->compiler = shaderc_compiler_initialize();
+    pthread_mutex_init(&reload->mutex, NULL);
+    context->hot_reload = reload;
+
+    int rc = pthread_create(&reload->thread, NULL, hot_reload_thread, context);
+    if (rc != 0)
+    {
+        dbg("could not create shader hot reload thread: %s\n", strerror(rc));
+        exit(1);
+    }
+
+    dbg("watching %s for shader changes\n", SHADER_DIR);
+}
+
+// Called by draw_frame at the start of every frame (after waiting on the frame's fence): swaps in
+// freshly reloaded pipelines, and destroys old ones that no frame in flight can be using anymore.
+static void vk_shader_hot_reload_swap(vk_context *context)
+{
+    shader_hot_reload *reload = context->hot_reload;
+
+    // same rule as vk_destroy_retired_swap_chains:
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < reload->retired_count; i++)
+    {
+        vk_pipeline_set *retired = &reload->retired[i];
+        if (context->frame_number + 1 < retired->retired_at + MAX_FRAMES_IN_FLIGHT)
+        {
+            reload->retired[kept++] = *retired;
+            continue;
+        }
+        vk_destroy_pipeline_set(context, retired);
+    }
+    reload->retired_count = kept;
+
+    pthread_mutex_lock(&reload->mutex);
+    bool pending = reload->pending;
+    vk_pipeline_set set = reload->pending_set;
+    reload->pending = false;
+    pthread_mutex_unlock(&reload->mutex);
+    if (!pending)
+    {
+        return;
+    }
+
+    // only happens when saving shaders faster than we can draw frames:
+    if (reload->retired_count == MAX_RETIRED_PIPELINE_SETS)
+    {
+        vkWaitForFences(context->logical_device, MAX_FRAMES_IN_FLIGHT, context->fences_in_flight,
+                        VK_TRUE, UINT64_MAX);
+        for (uint32_t i = 0; i < reload->retired_count; i++)
+        {
+            vk_destroy_pipeline_set(context, &reload->retired[i]);
+        }
+        reload->retired_count = 0;
+    }
+
+    // every variant we had was built from the old shaders, so they all go (including any startup
+    // builds that are still going):
+    vk_finish_pipeline_builds(context, true);
+    vk_pipeline_set *retired = &reload->retired[reload->retired_count++];
+    memcpy(retired->variants, context->pipeline_variants, sizeof(retired->variants));
+    retired->cull_pipeline = context->cull_pipeline;
+    retired->retired_at = context->frame_number;
+
+    memcpy(context->pipeline_variants, set.variants, sizeof(set.variants));
+    context->cull_pipeline = set.cull_pipeline;
+    // (builds the variant we're using now if it changed while the reloader was working)
+    vk_use_pipeline_features(context, context->pipeline_features);
+    dbg("swapped in reloaded pipelines\n");
+}
+
+// Stops the watcher thread and destroys any pipelines it left behind.  The device must be idle.
+void vk_shader_hot_reload_free(vk_context *context)
+{
+    shader_hot_reload *reload = context->hot_reload;
+    pthread_mutex_lock(&reload->mutex);
+    reload->stop = true;
+    pthread_mutex_unlock(&reload->mutex);
+    pthread_join(reload->thread, NULL);
+
+    if (reload->pending)
+    {
+        vk_destroy_pipeline_set(context, &reload->pending_set);
+    }
+    for (uint32_t i = 0; i < reload->retired_count; i++)
+    {
+        vk_destroy_pipeline_set(context, &reload->retired[i]);
+    }
+
+    shaderc_compiler_release(reload->compiler);
+    close(reload->inotify_fd);
+    pthread_mutex_destroy(&reload->mutex);
+    free(reload);
+    context->hot_reload = NULL;
+}
+#endif
+
+// Destroys retired swapchains (and the image views / framebuffers / render targets that went with
+// their images)
+// once no frame in flight can still be using them, or all of them if `force` is set, in which case
+// the caller must have made sure the GPU is done with them.
+static void vk_destroy_retired_swap_chains(vk_context *context, bool force)
+{
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < context->retired_swapchain_count; i++)
+    {
+        vk_retired_swapchain *retired = &context->retired_swapchains[i];
+        // Every frame before `retired_at` may have used it, and the last of those is finished once
+        // we've waited on its fence, which happens MAX_FRAMES_IN_FLIGHT - 1 frames later.  This
+        // doesn't strictly prove that the presentation engine is done with the old images, but
+        // it's what everyone does without VK_EXT_swapchain_maintenance1.
+        if (!force && context->frame_number + 1 < retired->retired_at + MAX_FRAMES_IN_FLIGHT)
+        {
+            context->retired_swapchains[kept++] = *retired;
+            continue;
+        }
+
+        for (uint32_t j = 0; j < retired->image_count; j++)
+        {
+            if (retired->framebuffers != NULL)
+            {
+                vkDestroyFramebuffer(context->logical_device, retired->framebuffers[j], NULL);
+            }
+            vkDestroyImageView(context->logical_device, retired->image_views[j], NULL);
+            vkDestroyImageView(context->logical_device, retired->depth_views[j], NULL);
+            vkDestroyImage(context->logical_device, retired->depth_images[j], NULL);
+            vk_free(context, &retired->depth_allocations[j]);
+            if (retired->msaa_images != NULL)
+            {
+                vkDestroyImageView(context->logical_device, retired->msaa_views[j], NULL);
+                vkDestroyImage(context->logical_device, retired->msaa_images[j], NULL);
+                vk_free(context, &retired->msaa_allocations[j]);
+            }
+        }
+        for (uint32_t j = 0; j < retired->image_count; j++)
+        {
+            vkDestroySemaphore(context->logical_device, retired->sem_render_finished[j], NULL);
+        }
+        vkDestroySwapchainKHR(context->logical_device, retired->swapchain, NULL);
+        free(retired->sem_render_finished);
+        free(retired->depth_allocations);
+        free(retired->depth_views);
+        free(retired->depth_images);
+        free(retired->msaa_allocations);
+        free(retired->msaa_views);
+        free(retired->msaa_images);
+        free(retired->framebuffers);
+        free(retired->image_views);
+        free(retired->images);
+    }
+    context->retired_swapchain_count = kept;
+}
+
+// Re-creates the swapchain after a resize / VK_ERROR_OUT_OF_DATE_KHR.  Only the swapchain and what
+// depends on its images (image views, render targets, framebuffers) get rebuilt; the render pass
+// and pipeline stay valid since the formats don't change and viewport / scissor are dynamic.  The
+// old objects are retired rather than destroyed, since frames still in flight may be using them.
+// Returns false if there's nothing to render to right now (i.e. the window is minimized).
+bool vk_recreate_swap_chain(vk_context *context)
+{
+    assert(!context->headless && "there's no swapchain to re-create in headless mode");
+
+    // the surface capabilities (currentExtent in particular) change with the window size:
+    free_swap_chain_support_details(context->swapchain_support);
+    context->swapchain_support =
+        query_swap_chain_support_details(context->physical_device, context->surface);
+
+    VkExtent2D extent = choose_swap_extent(context);
+    if (extent.width == 0 || extent.height == 0)
+    {
+        return false;
+    }
+
+    // this only fills up if we re-create on (almost) every frame, in which case just wait for the
+    // frames in flight to finish so we can get rid of all of them:
+    if (context->retired_swapchain_count == MAX_RETIRED_SWAPCHAINS)
+    {
+        vkWaitForFences(context->logical_device, MAX_FRAMES_IN_FLIGHT, context->fences_in_flight,
+                        VK_TRUE, UINT64_MAX);
+        vk_destroy_retired_swap_chains(context, true);
+    }
+
+    context->retired_swapchains[context->retired_swapchain_count++] = (vk_retired_swapchain){
+        .swapchain = context->swapchain,
+        .images = context->swapchain_images,
+        .image_views = context->image_views,
+        .framebuffers = context->framebuffers,
+        .depth_images = context->depth_images,
+        .depth_views = context->depth_views,
+        .depth_allocations = context->depth_allocations,
+        .msaa_images = context->msaa_images,
+        .msaa_views = context->msaa_views,
+        .msaa_allocations = context->msaa_allocations,
+        .sem_render_finished = context->sem_render_finished,
+        .image_count = context->swapchain_image_count,
+        .retired_at = context->frame_number,
+    };
+
+    VkFormat old_format = context->swapchain_image_format;
+    // (passes context->swapchain as oldSwapchain)
+    vk_init_swap_chain(context);
+    assert(context->swapchain_image_format == old_format &&
+           "swapchain format changed, which would need a new render pass");
+    (void)old_format;
+    vk_init_image_views(context);
+    // (the depth buffers / MSAA targets have to match the new extent)
+    vk_init_render_targets(context);
+    // (with dynamic rendering there's nothing else that points at the images)
+    if (!context->dynamic_rendering)
+    {
+        vk_init_frame_buffers(context);
+    }
+
+    vk_init_render_finished_semaphores(context);
+
+    // the new images aren't in use by anything yet:
+    free(context->images_in_flight);
+    context->images_in_flight = calloc(context->swapchain_image_count, sizeof(VkFence));
+
+    context->swapchain_dirty = false;
+    dbg("re-created swapchain at %dx%d\n", extent.width, extent.height);
+    return true;
+}
+
+void draw_frame(vk_context *context)
+{
+    uint32_t frame = context->current_frame;
+    VkCommandBuffer command_buffer = context->cmd_reset == CMD_RESET_POOL
+                                         ? context->frame_command_buffers[frame]
+                                         : context->command_buffers[frame];
+    assert(command_buffer != VK_NULL_HANDLE && "expected command buffers to be initialized\n");
+
+    bench_stats *bench = context->bench;
+    uint64_t t_start = now_ns();
+    if (bench != NULL && bench->last_frame_start_ns != 0)
+    {
+        bench_push_ns(bench, PHASE_FRAME, bench->last_frame_start_ns, t_start);
+    }
+
+    // wait for the GPU to finish the last frame that used this slot, which (with more than one
+    // frame in flight) is not the frame we just submitted
+    vkWaitForFences(context->logical_device, 1, &context->fences_in_flight[frame], VK_TRUE,
+                    UINT64_MAX);
+    vk_collect_timestamps(context, frame);
+    vk_frame_arena_reset(context, frame);
+    vk_destroy_retired_swap_chains(context, false);
+    vk_finish_pipeline_builds(context, false);
+#ifdef SHADER_HOT_RELOAD
+    vk_shader_hot_reload_swap(context);
+#endif
+    uint64_t t_waited = now_ns();
+
+    uint32_t image_index;
+    if (context->headless)
+    {
+        // offscreen images map 1:1 onto frame slots, and the fence we just waited on means that
+        // the frame that last rendered into this one is finished, so we can read it back now
+        image_index = frame;
+        vk_collect_readback(context, image_index);
+    }
+    else
+    {
+        // skip the frame if the window is minimized (the fence hasn't been reset yet, so waiting
+        // on it next time around is fine)
+        if (context->swapchain_dirty && !vk_recreate_swap_chain(context))
+        {
+            return;
+        }
+
+        // acquire an image from the swap chain
+        VkResult result = vkAcquireNextImageKHR(context->logical_device, context->swapchain,
+                                                UINT64_MAX, context->sem_image_available[frame],
+                                                VK_NULL_HANDLE, &image_index);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            // no image was acquired and the semaphore won't be signaled, so just try again with a
+            // new swapchain next frame
+            context->swapchain_dirty = true;
+            return;
+        }
+        else if (result == VK_SUBOPTIMAL_KHR)
+        {
+            // we still got an image, so draw this frame and re-create afterwards
+            context->swapchain_dirty = true;
+        }
+        else
+        {
+            vk_checked(result);
+        }
+    }
+
+    // the swapchain doesn't have to give us images in order, so a frame in another slot may still
+    // be rendering to this image:
+    if (context->images_in_flight[image_index] != VK_NULL_HANDLE)
+    {
+        vkWaitForFences(context->logical_device, 1, &context->images_in_flight[image_index],
+                        VK_TRUE, UINT64_MAX);
+    }
+    context->images_in_flight[image_index] = context->fences_in_flight[frame];
+
+    // only reset the fence once we know we are going to submit work that signals it
+    vkResetFences(context->logical_device, 1, &context->fences_in_flight[frame]);
+    uint64_t t_acquired = now_ns();
+
+    // kick off anything uploaded since the last frame, and find out whether we have to wait for
+    // it (this has to happen before recording, which consumes the pending acquires)
+    vk_upload_flush(context);
+    uint64_t upload_wait_value = vk_upload_pending_acquire(context);
+
+    // record a command buffer which draws the scene onto that image
+    if (context->cmd_reset == CMD_RESET_POOL)
+    {
+        vk_checked(vkResetCommandPool(context->logical_device, context->frame_command_pools[frame],
+                                      0));
+    }
+    else
+    {
+        vk_checked(vkResetCommandBuffer(command_buffer, 0));
+    }
+    vk_record_command_buffer(context, command_buffer, image_index);
+    uint64_t t_recorded = now_ns();
+
+    // submit the recorded command buffer (nothing to acquire or present in headless mode, so
+    // nothing to wait on or signal either)
+    uint32_t wait_count = 0;
+    VkSemaphore wait_semaphores[2];
+    VkPipelineStageFlags wait_stages[2];
+    uint64_t wait_values[2];
+    if (!context->headless)
+    {
+        wait_semaphores[wait_count] = context->sem_image_available[frame];
+        wait_stages[wait_count] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        wait_values[wait_count++] = 0; // ignored for binary semaphores
+    }
+    if (upload_wait_value != 0)
+    {
+        wait_semaphores[wait_count] = context->uploader.timeline;
+        wait_stages[wait_count] = UPLOAD_CONSUMER_STAGES;
+        wait_values[wait_count++] = upload_wait_value;
+    }
+    VkSemaphore signal_semaphores[] = {
+        context->headless ? VK_NULL_HANDLE : context->sem_render_finished[image_index],
+    };
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = wait_count,
+        .pWaitSemaphoreValues = wait_values,
+    };
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = upload_wait_value != 0 ? &timeline_info : NULL,
+        .waitSemaphoreCount = wait_count,
+        .pWaitSemaphores = wait_semaphores,
+        .pWaitDstStageMask = wait_stages,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &command_buffer,
+        .signalSemaphoreCount = context->headless ? 0 : 1,
+        .pSignalSemaphores = signal_semaphores,
+    };
+    vk_checked(vkQueueSubmit(context->graphics_queue, 1, &submit_info,
+                             context->fences_in_flight[frame]));
+    context->timestamps_pending[frame] = context->timestamp_pool != VK_NULL_HANDLE;
+    uint64_t t_submitted = now_ns();
+
+    if (bench != NULL)
+    {
+        bench->last_frame_start_ns = t_start;
+        bench_push_ns(bench, PHASE_WAIT, t_start, t_waited);
+        bench_push_ns(bench, PHASE_ACQUIRE, t_waited, t_acquired);
+        bench_push_ns(bench, PHASE_RECORD, t_acquired, t_recorded);
+        bench_push_ns(bench, PHASE_SUBMIT, t_recorded, t_submitted);
+    }
+
+    context->current_frame = (frame + 1) % MAX_FRAMES_IN_FLIGHT;
+    if (context->headless)
+    {
+        context->readback_pending[image_index] = context->frame_number++;
+        return;
+    }
+    context->frame_number++;
+
+    // present the swap chain image
+    VkSwapchainKHR swapchains[] = {context->swapchain};
+    VkPresentInfoKHR present_info = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = signal_semaphores,
+        .swapchainCount = 1,
+        .pSwapchains = swapchains,
+        .pImageIndices = &image_index,
+        .pResults = NULL,
+    };
+
+    VkResult result = vkQueuePresentKHR(context->presentation_queue, &present_info);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+    {
+        context->swapchain_dirty = true;
+    }
+    else
+    {
+        vk_checked(result);
+    }
+
+    if (bench != NULL)
+    {
+        bench_push_ns(bench, PHASE_PRESENT, t_submitted, now_ns());
+    }
+}
+
+// Headless only: waits for all submitted frames and hands the ones that haven't been read back yet
+// to the readback callback.
+void vk_finish_readbacks(vk_context *context)
+{
+    vkDeviceWaitIdle(context->logical_device);
+
+    // collect in submission order so the callback sees frames in the order they were rendered:
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        vk_collect_readback(context, (context->current_frame + i) % MAX_FRAMES_IN_FLIGHT);
+    }
+}
 
-    VkCommandBuffer command_buffer;
-    vk_checked(
-        vkAllocateCommandBuffers(context->logical_device, &buffer_alloc_info, &command_buffer));
+typedef struct bench_summary
+{
+    uint32_t count;
+    double min, mean, p50, p95, p99, max;
+} bench_summary;
 
-    context->command_buffer = command_buffer;
-    dbg("sucessfully initialized command buffer\n");
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
 }
 
-void vk_record_command_buffer(vk_context *context, uint32_t image_index)
+// nearest-rank percentile of an already sorted array:
+static double percentile(const double *sorted, uint32_t count, double p)
 {
-    VkCommandBufferBeginInfo begin_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = 0,
-        .pInheritanceInfo = NULL,
-    };
+    uint32_t rank = (uint32_t)(p / 100.0 * count + 0.999999);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
 
-    vk_checked(vkBeginCommandBuffer(context->command_buffer, &begin_info));
+static bench_summary bench_series_summarize(const bench_series *series)
+{
+    bench_summary summary = {.count = series->count};
+    if (series->count == 0)
+    {
+        return summary;
+    }
 
-    VkClearValue clear_color = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-    VkRenderPassBeginInfo render_pass_info = {
-        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-        .renderPass = context->render_pass,
-        .framebuffer = context->framebuffers[image_index],
-        .renderArea =
-            (VkRect2D){
-                .extent = context->swapchain_extent,
-                .offset = {0, 0},
-            },
-        .clearValueCount = 1,
-        .pClearValues = &clear_color,
-    };
+    double *sorted = malloc(series->count * sizeof(double));
+    memcpy(sorted, series->samples_ms, series->count * sizeof(double));
+    qsort(sorted, series->count, sizeof(double), compare_doubles);
 
-    vkCmdBeginRenderPass(context->command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(context->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, context->pipeline);
+    double total = 0.0;
+    for (uint32_t i = 0; i < series->count; i++)
+    {
+        total += sorted[i];
+    }
 
-    vkCmdDraw(context->command_buffer, 3, 1, 0, 0);
-    vkCmdEndRenderPass(context->command_buffer);
-    vk_checked(vkEndCommandBuffer(context->command_buffer));
+    summary.min = sorted[0];
+    summary.mean = total / series->count;
+    summary.p50 = percentile(sorted, series->count, 50.0);
+    summary.p95 = percentile(sorted, series->count, 95.0);
+    summary.p99 = percentile(sorted, series->count, 99.0);
+    summary.max = sorted[series->count - 1];
+    free(sorted);
+    return summary;
+}
 
-    dbg("successfully recorded image %d to command buffer\n", image_index);
+static void write_summary_json(FILE *file, const char *name, const bench_series *series,
+                               bool last)
+{
+    bench_summary summary = bench_series_summarize(series);
+    fprintf(file,
+            "    \"%s\": {\"count\": %u, \"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, "
+            "\"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n",
+            name, summary.count, summary.min, summary.mean, summary.p50, summary.p95, summary.p99,
+            summary.max, last ? "" : ",");
 }
 
-void vk_init_sync(vk_context *context)
+// Writes `string` as a JSON string literal, quotes and escapes included.
+static void write_json_string(FILE *file, const char *string)
 {
-    VkSemaphoreCreateInfo sem_info = {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-    };
+    fputc('"', file);
+    for (const char *c = string; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fprintf(file, "\\%c", *c);
+        }
+        else if ((unsigned char)*c < 0x20)
+        {
+            fprintf(file, "\\u%04x", (unsigned char)*c);
+        }
+        else
+        {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
 
-    VkFenceCreateInfo fence_info = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        // Start in the signaled state so the first draw_frame call isn't waiting
-        .flags = VK_FENCE_CREATE_SIGNALED_BIT,
-    };
+// Prints a summary of a --bench run to stdout and writes the full report as JSON to `path`, so
+// that runs can be diffed between builds.  All times are in milliseconds.
+void bench_report(vk_context *context, const char *path)
+{
+    bench_stats *stats = context->bench;
 
-    vk_checked(
-        vkCreateSemaphore(context->logical_device, &sem_info, NULL, &context->sem_image_available));
-    vk_checked(
-        vkCreateSemaphore(context->logical_device, &sem_info, NULL, &context->sem_render_finished));
-    vk_checked(
-        vkCreateFence(context->logical_device, &fence_info, NULL, &context->fence_in_flight));
+    printf("command reset: %s\n", cmd_reset_mode_names[context->cmd_reset]);
+    printf("%-10s %8s %8s %8s %8s %8s %8s\n", "(ms)", "min", "mean", "p50", "p95", "p99", "max");
+    for (uint32_t i = 0; i < PHASE_COUNT; i++)
+    {
+        bench_summary summary = bench_series_summarize(&stats->cpu[i]);
+        printf("cpu %-6s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", frame_phase_names[i],
+               summary.min, summary.mean, summary.p50, summary.p95, summary.p99, summary.max);
+    }
+    for (uint32_t i = 0; i < GPU_PASS_COUNT && context->timestamp_pool != VK_NULL_HANDLE; i++)
+    {
+        bench_summary summary = bench_series_summarize(&stats->gpu[i]);
+        printf("gpu %-6s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", gpu_pass_names[i], summary.min,
+               summary.mean, summary.p50, summary.p95, summary.p99, summary.max);
+    }
 
-    dbg("successfully initialized semaphores and fences\n");
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        dbg("could not open %s for writing: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"device\": ");
+    write_json_string(file, context->physical_device_props.deviceName);
+    fprintf(file, ",\n");
+    fprintf(file, "  \"headless\": %s,\n", context->headless ? "true" : "false");
+    fprintf(file, "  \"frames_in_flight\": %d,\n", MAX_FRAMES_IN_FLIGHT);
+    fprintf(file, "  \"command_reset\": \"%s\",\n", cmd_reset_mode_names[context->cmd_reset]);
+    fprintf(file, "  \"record_threads\": %u,\n", context->record_slice_count);
+    fprintf(file, "  \"objects\": %u,\n", context->draw_count);
+    fprintf(file, "  \"gpu_cull\": %s,\n", context->gpu_cull ? "true" : "false");
+    fprintf(file, "  \"instances\": %u,\n", context->instance_count);
+    fprintf(file, "  \"extent\": [%u, %u],\n", context->swapchain_extent.width,
+            context->swapchain_extent.height);
+
+    vk_allocator_stats mem = vk_allocator_get_stats(context);
+    fprintf(file,
+            "  \"memory\": {\"blocks\": %u, \"dedicated\": %u, \"bytes_allocated\": %llu, "
+            "\"bytes_used\": %llu, \"bytes_requested\": %llu, \"fragmentation\": %.4f, "
+            "\"frame_arena_high_water\": %llu},\n",
+            mem.block_count, mem.dedicated_count, (unsigned long long)mem.bytes_allocated,
+            (unsigned long long)mem.bytes_used, (unsigned long long)mem.bytes_requested,
+            mem.fragmentation, (unsigned long long)context->frame_arena.high_water);
+
+    fprintf(file, "  \"cpu_ms\": {\n");
+    for (uint32_t i = 0; i < PHASE_COUNT; i++)
+    {
+        write_summary_json(file, frame_phase_names[i], &stats->cpu[i], i == PHASE_COUNT - 1);
+    }
+    fprintf(file, "  },\n");
+
+    if (context->timestamp_pool == VK_NULL_HANDLE)
+    {
+        fprintf(file, "  \"gpu_ms\": null\n");
+    }
+    else
+    {
+        fprintf(file, "  \"gpu_ms\": {\n");
+        for (uint32_t i = 0; i < GPU_PASS_COUNT; i++)
+        {
+            write_summary_json(file, gpu_pass_names[i], &stats->gpu[i], i == GPU_PASS_COUNT - 1);
+        }
+        fprintf(file, "  }\n");
+    }
+    fprintf(file, "}\n");
+
+    if (ferror(file))
+    {
+        dbg("error writing to %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    fclose(file);
+    dbg("wrote benchmark report to %s\n", path);
 }
 
-void draw_frame(vk_context *context)
+void bench_stats_free(bench_stats *stats)
 {
-    assert(context->command_buffer != VK_NULL_HANDLE &&
-           "expected command buffer to be initialized\n");
-    // wait for the previous frame to finish
-    vkWaitForFences(context->logical_device, 1, &context->fence_in_flight, VK_TRUE, UINT64_MAX);
-    vkResetFences(context->logical_device, 1, &context->fence_in_flight);
+    for (uint32_t i = 0; i < PHASE_COUNT; i++)
+    {
+        free(stats->cpu[i].samples_ms);
+    }
+    for (uint32_t i = 0; i < GPU_PASS_COUNT; i++)
+    {
+        free(stats->gpu[i].samples_ms);
+    }
+    free(stats);
+}
 
-    // acquire an image from the swap chain
-    uint32_t image_index;
-    vkAcquireNextImageKHR(context->logical_device, context->swapchain, UINT64_MAX,
-                          context->sem_image_available, VK_NULL_HANDLE, &image_index);
+// Reports and frees context->bench once all frames have finished on the GPU.  With `per_mode` set
+// the report goes to `path` with the command reset mode spliced in before the extension
+// (bench.json -> bench.pool.json) so that --cmd-reset compare runs don't overwrite each other.
+static void bench_finish(vk_context *context, const char *path, bool per_mode)
+{
+    // the last few frames were still in flight when the run ended:
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        vk_collect_timestamps(context, i);
+    }
 
-    // record a command buffer which draws the scene onto that image
-    vkResetCommandBuffer(context->command_buffer, 0);
-    vk_record_command_buffer(context, image_index);
+    char mode_path[4096];
+    if (per_mode)
+    {
+        const char *mode = cmd_reset_mode_names[context->cmd_reset];
+        const char *ext = strrchr(path, '.');
+        const char *dir_end = strrchr(path, '/');
+        if (dir_end != NULL && ext != NULL && ext < dir_end)
+        {
+            ext = NULL;
+        }
+        int stem_length = ext != NULL ? (int)(ext - path) : (int)strlen(path);
+        snprintf(mode_path, sizeof(mode_path), "%.*s.%s%s", stem_length, path, mode,
+                 ext != NULL ? ext : "");
+        path = mode_path;
+    }
 
-    // submit the recorded command buffer
-    VkSemaphore wait_semaphores[] = {context->sem_image_available};
-    VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    VkSemaphore signal_semaphores[] = {context->sem_render_finished};
+    bench_report(context, path);
+    bench_stats_free(context->bench);
+    context->bench = NULL;
+}
 
-    VkSubmitInfo submit_info = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = wait_semaphores,
-        .pWaitDstStageMask = wait_stages,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &context->command_buffer,
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = signal_semaphores,
-    };
-    vk_checked(vkQueueSubmit(context->graphics_queue, 1, &submit_info, context->fence_in_flight));
+typedef struct app_options
+{
+    bool headless;
+    // headless: how many frames to render before exiting
+    uint32_t frame_count;
+    // headless: directory that every frame is written to as frame_NNNNN.ppm (NULL = don't write)
+    const char *output_dir;
+    // number of frames to measure with --bench (0 = not benchmarking), and where the JSON report
+    // goes
+    uint32_t bench_frames;
+    const char *bench_output;
+    // how many times to draw the mesh each frame, and how many threads to record the draws on
+    // (0 = record on the main thread)
+    uint32_t draw_count;
+    uint32_t record_threads;
+    // --cmd-reset: how command buffers get reset, or (compare) benchmark both one after the other
+    cmd_reset_mode cmd_reset;
+    bool cmd_reset_compare;
+    // cull and draw the scene on the GPU instead of one draw call per object
+    bool gpu_cull;
+    // draw this many instances of the mesh in one instanced draw instead of the scene (0 = off)
+    uint32_t instance_count;
+    // start with the PIPELINE_FEATURE_DEBUG_OBJECTS permutation
+    bool debug_objects;
+    // use a VkRenderPass + framebuffers even if the device can do dynamic rendering
+    bool render_pass;
+    // lay down depth for everything before shading anything
+    bool depth_prepass;
+    // samples per pixel (rounded down to what the device supports)
+    uint32_t msaa_samples;
+    // KTX2 files to stream and put on the objects, and the most memory they may use (0 = decide
+    // from VK_EXT_memory_budget)
+    const char *texture_paths[MAX_TEXTURES];
+    uint32_t texture_count;
+    VkDeviceSize texture_budget;
+    // name (or part of it) or UUID of the device to use, instead of the best scoring one
+    const char *device;
+} app_options;
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [--headless] [--frames N] [--output DIR] [--bench N] [--bench-output FILE]\n"
+            "          [--draws N] [--record-threads N] [--cmd-reset buffer|pool|compare]\n"
+            "          [--gpu-cull] [--instances N] [--debug-objects] [--render-pass]\n"
+            "          [--depth-prepass] [--msaa N] [--texture FILE]... [--texture-budget MB]\n"
+            "          [--device NAME|UUID]\n"
+            "  --headless           render offscreen without a window or swapchain\n"
+            "  --frames N           number of frames to render in headless mode (default 1)\n"
+            "  --output DIR         write headless frames to DIR/frame_NNNNN.ppm\n"
+            "  --bench N            render N frames, then report CPU and GPU frame times\n"
+            "  --bench-output FILE  where to write the JSON benchmark report (default "
+            "bench.json)\n"
+            "  --draws N            draw the mesh N times per frame (default 1)\n"
+            "  --record-threads N   record draws into secondary command buffers on N worker\n"
+            "                       threads (default 0 = record on the main thread)\n"
+            "  --cmd-reset MODE     reset command buffers one by one (buffer) or by resetting a\n"
+            "                       pool per frame (pool, the default).  compare runs --bench\n"
+            "                       once with each and writes one report per mode\n"
+            "  --gpu-cull           frustum cull on the GPU and draw with indirect draws\n"
+            "  --instances N        draw N instances of the mesh in one instanced draw call,\n"
+            "                       with per-instance data streamed every frame\n"
+            "  --debug-objects      color each object / instance by its index (O toggles it)\n"
+            "  --render-pass        render with a VkRenderPass and framebuffers instead of\n"
+            "                       dynamic rendering\n"
+            "  --depth-prepass      draw depth only first, then shade just the visible pixels\n"
+            "  --msaa N             anti-alias with N samples per pixel (default 1 = off)\n"
+            "  --texture FILE       stream a KTX2 texture onto the objects (can be repeated)\n"
+            "  --texture-budget MB  most memory streamed textures may use (default: what\n"
+            "                       VK_EXT_memory_budget says is free)\n"
+            "  --device NAME|UUID   render on the device whose name contains NAME, or with this\n"
+            "                       UUID, instead of the best one (also " DEVICE_ENV_VAR ")\n",
+            program);
+}
 
-    // present the swap chain image
-    VkSwapchainKHR swapchains[] = {context->swapchain};
-    VkPresentInfoKHR present_info = {
-        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = signal_semaphores,
-        .swapchainCount = 1,
-        .pSwapchains = swapchains,
-        .pImageIndices = &image_index,
-        .pResults = NULL,
+static app_options parse_args(int argc, char **argv)
+{
+    app_options options = {
+        .headless = false,
+        .frame_count = 1,
+        .output_dir = NULL,
+        .bench_frames = 0,
+        .bench_output = "bench.json",
+        .draw_count = 1,
+        .record_threads = 0,
+        .cmd_reset = CMD_RESET_POOL,
+        .cmd_reset_compare = false,
+        .gpu_cull = false,
+        .instance_count = 0,
+        .debug_objects = false,
+        .render_pass = false,
+        .depth_prepass = false,
+        .msaa_samples = 1,
+        .texture_count = 0,
+        .texture_budget = 0,
+        .device = NULL,
     };
 
-    vkQueuePresentKHR(context->presentation_queue, &present_info);
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--headless") == 0)
+        {
+            options.headless = true;
+        }
+        else if (strcmp(arg, "--frames") == 0 && i + 1 < argc)
+        {
+            options.frame_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(arg, "--output") == 0 && i + 1 < argc)
+        {
+            options.output_dir = argv[++i];
+        }
+        else if (strcmp(arg, "--bench") == 0 && i + 1 < argc)
+        {
+            options.bench_frames = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(arg, "--bench-output") == 0 && i + 1 < argc)
+        {
+            options.bench_output = argv[++i];
+        }
+        else if (strcmp(arg, "--draws") == 0 && i + 1 < argc)
+        {
+            options.draw_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+            if (options.draw_count == 0)
+            {
+                fprintf(stderr, "--draws needs at least 1 object\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(arg, "--record-threads") == 0 && i + 1 < argc)
+        {
+            options.record_threads = (uint32_t)strtoul(argv[++i], NULL, 10);
+            if (options.record_threads > MAX_WORKER_THREADS)
+            {
+                fprintf(stderr, "--record-threads can be at most %d\n", MAX_WORKER_THREADS);
+                exit(1);
+            }
+        }
+        else if (strcmp(arg, "--gpu-cull") == 0)
+        {
+            options.gpu_cull = true;
+        }
+        else if (strcmp(arg, "--instances") == 0 && i + 1 < argc)
+        {
+            options.instance_count = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(arg, "--debug-objects") == 0)
+        {
+            options.debug_objects = true;
+        }
+        else if (strcmp(arg, "--render-pass") == 0)
+        {
+            options.render_pass = true;
+        }
+        else if (strcmp(arg, "--depth-prepass") == 0)
+        {
+            options.depth_prepass = true;
+        }
+        else if (strcmp(arg, "--msaa") == 0 && i + 1 < argc)
+        {
+            options.msaa_samples = (uint32_t)strtoul(argv[++i], NULL, 10);
+            if (options.msaa_samples < 1)
+            {
+                fprintf(stderr, "--msaa needs at least 1 sample\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(arg, "--texture") == 0 && i + 1 < argc)
+        {
+            if (options.texture_count == MAX_TEXTURES)
+            {
+                fprintf(stderr, "at most %d --texture files\n", MAX_TEXTURES);
+                exit(1);
+            }
+            options.texture_paths[options.texture_count++] = argv[++i];
+        }
+        else if (strcmp(arg, "--texture-budget") == 0 && i + 1 < argc)
+        {
+            options.texture_budget = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+        }
+        else if (strcmp(arg, "--device") == 0 && i + 1 < argc)
+        {
+            options.device = argv[++i];
+        }
+        else if (strcmp(arg, "--cmd-reset") == 0 && i + 1 < argc)
+        {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "buffer") == 0)
+            {
+                options.cmd_reset = CMD_RESET_BUFFER;
+            }
+            else if (strcmp(mode, "pool") == 0)
+            {
+                options.cmd_reset = CMD_RESET_POOL;
+            }
+            else if (strcmp(mode, "compare") == 0)
+            {
+                options.cmd_reset_compare = true;
+            }
+            else
+            {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        }
+        else
+        {
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    // compare means two benchmark runs, so there's nothing to compare without --bench:
+    if (options.cmd_reset_compare && options.bench_frames == 0)
+    {
+        fprintf(stderr, "--cmd-reset compare needs --bench N\n");
+        exit(1);
+    }
+
+    return options;
 }
 
-int main()
+// vk_readback_fn that writes each frame to `<user_data>/frame_NNNNN.ppm`.  PPM is about the
+// simplest image format there is (a text header + raw RGB bytes), so we don't need a library.
+static void write_ppm_frame(const uint8_t *pixels, uint32_t width, uint32_t height,
+                            uint64_t frame_number, void *user_data)
 {
-    SDL_Window *window =
-        SDL_CreateWindow("vulkan demo", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 640, 480,
-                         SDL_WINDOW_SHOWN | SDL_WINDOW_VULKAN | SDL_WINDOW_ALLOW_HIGHDPI);
+    const char *output_dir = user_data;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/frame_%05llu.ppm", output_dir,
+             (unsigned long long)frame_number);
 
-    if (window == NULL)
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
     {
-        dbg("could not create window: %s\n", SDL_GetError());
+        dbg("could not open %s for writing: %s\n", path, strerror(errno));
         exit(1);
     }
 
-    if (0 != SDL_Vulkan_LoadLibrary(NULL))
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+
+    // PPM has no alpha channel, so drop it one row at a time:
+    uint8_t row[width * 3];
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const uint8_t *src = pixels + (size_t)y * width * 4;
+        for (uint32_t x = 0; x < width; x++)
+        {
+            row[x * 3 + 0] = src[x * 4 + 0];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 2];
+        }
+        fwrite(row, 1, sizeof(row), file);
+    }
+
+    if (ferror(file))
     {
-        dbg("sdl could not load required vulkan functions: %s", SDL_GetError());
+        dbg("error writing to %s: %s\n", path, strerror(errno));
         exit(1);
     }
 
+    fclose(file);
+    dbg("wrote frame %llu to %s\n", (unsigned long long)frame_number, path);
+}
+
+int main(int argc, char **argv)
+{
+    app_options options = parse_args(argc, argv);
+
+    SDL_Window *window = NULL;
+    if (!options.headless)
+    {
+        window = SDL_CreateWindow("vulkan demo", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                                  WINDOW_WIDTH, WINDOW_HEIGHT,
+                                  SDL_WINDOW_SHOWN | SDL_WINDOW_VULKAN | SDL_WINDOW_ALLOW_HIGHDPI |
+                                      SDL_WINDOW_RESIZABLE);
+
+        if (window == NULL)
+        {
+            dbg("could not create window: %s\n", SDL_GetError());
+            exit(1);
+        }
+
+        if (0 != SDL_Vulkan_LoadLibrary(NULL))
+        {
+            dbg("sdl could not load required vulkan functions: %s", SDL_GetError());
+            exit(1);
+        }
+    }
+
     vk_context *ctx = vk_context_alloc(window);
     vk_init_instance(ctx, "vulkan demo", window);
-    vk_init_surface(ctx, window);
-    vk_init_physical_device(ctx);
+    if (!ctx->headless)
+    {
+        vk_init_surface(ctx, window);
+    }
+    vk_init_physical_device(ctx, options.device);
+    ctx->dynamic_rendering = !options.render_pass;
     vk_init_logical_device(ctx);
     vk_init_queue_handles(ctx);
-    vk_init_swap_chain(ctx);
+    vk_init_allocator(ctx);
+    vk_init_frame_arena(ctx);
+    vk_init_uploader(ctx);
+    vk_init_bindless(ctx);
+    if (options.texture_count > 0)
+    {
+        vk_init_textures(ctx, options.texture_paths, options.texture_count,
+                         options.texture_budget);
+    }
+    vk_init_mesh(ctx);
+    vk_init_scene(ctx, options.draw_count);
+    vk_init_frame_uniforms(ctx);
+    if (options.instance_count > 0)
+    {
+        vk_init_instances(ctx, options.instance_count);
+    }
+    if (ctx->headless)
+    {
+        vk_init_offscreen_targets(ctx, WINDOW_WIDTH, WINDOW_HEIGHT);
+    }
+    else
+    {
+        vk_init_swap_chain(ctx);
+    }
     vk_init_image_views(ctx);
-    vk_init_render_pass(ctx);
+    ctx->msaa_samples = choose_sample_count(ctx, options.msaa_samples);
+    vk_init_render_targets(ctx);
+    if (!ctx->dynamic_rendering)
+    {
+        vk_init_render_pass(ctx);
+    }
+    vk_init_pipeline_cache(ctx);
+    vk_open_shader_archive(ctx);
+    if (options.debug_objects)
+    {
+        ctx->pipeline_features |= PIPELINE_FEATURE_DEBUG_OBJECTS;
+    }
+    ctx->depth_prepass = options.depth_prepass;
     vk_init_graphics_pipeline(ctx);
-    vk_init_frame_buffers(ctx);
+    if (!ctx->dynamic_rendering)
+    {
+        vk_init_frame_buffers(ctx);
+    }
     vk_init_command_pool(ctx);
     vk_init_command_buffers(ctx);
+    if (options.gpu_cull && !ctx->multi_draw_indirect)
+    {
+        dbg("device doesn't support multiDrawIndirect, ignoring --gpu-cull\n");
+    }
+    else if (options.gpu_cull)
+    {
+        vk_init_gpu_culling(ctx);
+    }
+    // every pipeline layout exists now, so start compiling pipelines while we set up the rest:
+    vk_start_pipeline_builds(ctx);
+    // (with gpu culling or instancing there's only one draw call to record, so no point in
+    // threads)
+    if (options.record_threads > 0 && !ctx->gpu_cull && ctx->instance_count == 0)
+    {
+        vk_init_record_threads(ctx, options.record_threads);
+    }
     vk_init_sync(ctx);
+#ifdef SHADER_HOT_RELOAD
+    vk_init_shader_hot_reload(ctx);
+#endif
+    if (options.bench_frames > 0)
+    {
+        vk_init_timestamp_queries(ctx);
+    }
+
+    // the first frame only needs the pipelines it draws with, the others can keep building:
+    vk_use_pipeline_features(ctx, ctx->pipeline_features);
+    if (ctx->gpu_cull)
+    {
+        vk_wait_for_pipeline_build(ctx, PIPELINE_BUILD_CULL);
+    }
 
     dbg("succesfully initialized vulkan\n");
 
+    if (ctx->headless && options.output_dir != NULL)
+    {
+        ctx->readback_callback = write_ppm_frame;
+        ctx->readback_user_data = (void *)options.output_dir;
+    }
+
+    // --cmd-reset compare benchmarks CMD_RESET_BUFFER first, then CMD_RESET_POOL:
+    bool compare = options.cmd_reset_compare;
+    ctx->cmd_reset = compare ? CMD_RESET_BUFFER : options.cmd_reset;
+
+    // windowed mode runs until the window is closed, unless we're benchmarking:
+    uint64_t frame_limit = ctx->headless ? options.frame_count : UINT64_MAX;
+    uint64_t bench_run_length = BENCH_WARMUP_FRAMES + options.bench_frames;
+    if (options.bench_frames > 0)
+    {
+        frame_limit = bench_run_length * (compare ? 2 : 1);
+    }
+
     bool running = true;
     SDL_Event event;
-    while (running)
+    for (uint64_t i = 0; running && i < frame_limit; i++)
     {
-        while (SDL_PollEvent(&event))
+        if (options.bench_frames > 0 && i > 0 && i % bench_run_length == 0)
+        {
+            // end of the first --cmd-reset compare run.  Waiting for idle is fine here since we're
+            // between measurements:
+            vkDeviceWaitIdle(ctx->logical_device);
+            bench_finish(ctx, options.bench_output, compare);
+            ctx->cmd_reset = CMD_RESET_POOL;
+        }
+        if (options.bench_frames > 0 && i % bench_run_length == BENCH_WARMUP_FRAMES)
+        {
+            ctx->bench = bench_stats_alloc(options.bench_frames);
+        }
+
+        while (!ctx->headless && SDL_PollEvent(&event))
         {
             if (event.type == SDL_QUIT)
             {
@@ -1246,8 +7600,57 @@ int main()
                 running = false;
                 break;
             }
+
+            // not every platform reports VK_ERROR_OUT_OF_DATE_KHR on resize, so don't rely on it:
+            if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+            {
+                ctx->swapchain_dirty = true;
+            }
+
+            if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_o)
+            {
+                vk_use_pipeline_features(ctx,
+                                         ctx->pipeline_features ^ PIPELINE_FEATURE_DEBUG_OBJECTS);
+            }
+        }
+
+        // there's nothing to draw to while minimized, so block until something happens instead of
+        // spinning:
+        if (!ctx->headless && (SDL_GetWindowFlags(window) & SDL_WINDOW_MINIMIZED))
+        {
+            SDL_WaitEvent(NULL);
+            continue;
         }
         draw_frame(ctx);
     }
-    vkDeviceWaitIdle(ctx->logical_device);
+
+    if (ctx->headless)
+    {
+        vk_finish_readbacks(ctx);
+    }
+    else
+    {
+        vkDeviceWaitIdle(ctx->logical_device);
+    }
+    vk_finish_pipeline_builds(ctx, true);
+    vk_close_shader_archive(ctx);
+    vk_textures_free(ctx);
+#ifdef SHADER_HOT_RELOAD
+    vk_shader_hot_reload_free(ctx);
+#endif
+    vk_save_pipeline_cache(ctx);
+    if (ctx->jobs != NULL)
+    {
+        job_pool_free(ctx->jobs);
+    }
+
+    vk_allocator_stats mem = vk_allocator_get_stats(ctx);
+    dbg("gpu memory: %u blocks + %u dedicated, %llu of %llu bytes used, fragmentation %.2f\n",
+        mem.block_count, mem.dedicated_count, (unsigned long long)mem.bytes_used,
+        (unsigned long long)mem.bytes_allocated, mem.fragmentation);
+
+    if (ctx->bench != NULL)
+    {
+        bench_finish(ctx, options.bench_output, compare);
+    }
 }
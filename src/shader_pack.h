@@ -0,0 +1,65 @@
+#pragma once
+
+// On-disk format of the shader archive that tools/pack_shaders.c writes and main.c maps at startup.
+// Everything is little endian, which is fine because SPIR-V has to be in host order for Vulkan
+// anyway.
+//
+//     shader_pack_header
+//     shader_pack_entry[header.entry_count]
+//     module data, each module starting on a SHADER_PACK_ALIGNMENT boundary
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHADER_PACK_MAGIC 0x4b415053u // "SPAK"
+#define SHADER_PACK_VERSION 1u
+#define SHADER_PACK_ALIGNMENT 16u
+#define SHADER_PACK_NAME_SIZE 64
+#define SHADER_PACK_ENTRY_POINT_SIZE 32
+
+// Same values as VkShaderStageFlagBits, so the packer doesn't need the vulkan headers:
+enum
+{
+    SHADER_PACK_STAGE_VERTEX = 0x00000001,
+    SHADER_PACK_STAGE_FRAGMENT = 0x00000010,
+    SHADER_PACK_STAGE_COMPUTE = 0x00000020,
+};
+
+typedef struct shader_pack_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t reserved;
+} shader_pack_header;
+
+typedef struct shader_pack_entry
+{
+    // source file name without the .spv, e.g. "shader.vert" (always nul terminated)
+    char name[SHADER_PACK_NAME_SIZE];
+    char entry_point[SHADER_PACK_ENTRY_POINT_SIZE];
+    uint32_t stage;
+    uint32_t reserved;
+    // FNV-1a of the module's bytes, checked by main.c before it creates the module (and lets
+    // tools tell whether a module changed without comparing the whole thing)
+    uint64_t hash;
+    // from the start of the archive, in bytes
+    uint64_t offset;
+    uint64_t size;
+} shader_pack_entry;
+
+static_assert(sizeof(shader_pack_header) == 16, "shader_pack_header layout changed");
+static_assert(sizeof(shader_pack_entry) == 128, "shader_pack_entry layout changed");
+
+static inline uint64_t shader_pack_hash(const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
@@ -0,0 +1,180 @@
+// Packs compiled SPIR-V modules into a single archive (see src/shader_pack.h), so the app can open
+// and map one file at startup instead of one per shader.
+//
+//     pack_shaders <out.pak> <shader.vert.spv> <shader.frag.spv> ...
+//
+// Modules are named after their file name without the directory or the .spv, and the stage comes
+// from the extension before that, the same way glslc picks it.
+
+#include "../src/shader_pack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SPIRV_MAGIC 0x07230203u
+
+typedef struct module
+{
+    shader_pack_entry entry;
+    void *data;
+} module;
+
+static void die(const char *fmt, const char *arg)
+{
+    fprintf(stderr, "pack_shaders: ");
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static uint32_t stage_from_name(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    if (ext == NULL)
+    {
+        die("can't tell the shader stage of %s", name);
+    }
+
+    if (strcmp(ext, ".vert") == 0)
+    {
+        return SHADER_PACK_STAGE_VERTEX;
+    }
+    if (strcmp(ext, ".frag") == 0)
+    {
+        return SHADER_PACK_STAGE_FRAGMENT;
+    }
+    if (strcmp(ext, ".comp") == 0)
+    {
+        return SHADER_PACK_STAGE_COMPUTE;
+    }
+    die("can't tell the shader stage of %s", name);
+    return 0;
+}
+
+static void read_module(const char *path, module *out)
+{
+    const char *name = strrchr(path, '/');
+    name = name == NULL ? path : name + 1;
+    size_t name_length = strlen(name);
+    if (name_length <= 4 || strcmp(name + name_length - 4, ".spv") != 0)
+    {
+        die("%s is not a .spv file", path);
+    }
+    name_length -= 4;
+    if (name_length >= SHADER_PACK_NAME_SIZE)
+    {
+        die("name of %s is too long", path);
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        die("could not open %s", path);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size < 20 || size % 4 != 0)
+    {
+        die("%s is not SPIR-V (bad size)", path);
+    }
+
+    out->data = malloc(size);
+    if (out->data == NULL || fread(out->data, 1, size, file) != (size_t)size)
+    {
+        die("could not read %s", path);
+    }
+    fclose(file);
+
+    uint32_t magic;
+    memcpy(&magic, out->data, sizeof(magic));
+    if (magic != SPIRV_MAGIC)
+    {
+        die("%s is not SPIR-V (bad magic number)", path);
+    }
+
+    memset(&out->entry, 0, sizeof(out->entry));
+    memcpy(out->entry.name, name, name_length);
+    out->entry.stage = stage_from_name(out->entry.name);
+    // all of our shaders use main; if that ever changes this should come from the command line
+    strcpy(out->entry.entry_point, "main");
+    out->entry.hash = shader_pack_hash(out->data, size);
+    out->entry.size = size;
+}
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: pack_shaders <out.pak> <module.spv>...\n");
+        return 1;
+    }
+
+    uint32_t count = argc - 2;
+    module *modules = calloc(count > 0 ? count : 1, sizeof(module));
+    uint64_t offset =
+        sizeof(shader_pack_header) + (uint64_t)count * sizeof(shader_pack_entry);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        read_module(argv[i + 2], &modules[i]);
+        for (uint32_t j = 0; j < i; j++)
+        {
+            if (strcmp(modules[j].entry.name, modules[i].entry.name) == 0)
+            {
+                die("%s is in the archive twice", modules[i].entry.name);
+            }
+        }
+
+        offset = align_up(offset, SHADER_PACK_ALIGNMENT);
+        modules[i].entry.offset = offset;
+        offset += modules[i].entry.size;
+    }
+
+    // write to a temporary file and rename it, so a failed build never leaves half an archive:
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", argv[1]);
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL)
+    {
+        die("could not open %s", tmp_path);
+    }
+
+    shader_pack_header header = {
+        .magic = SHADER_PACK_MAGIC,
+        .version = SHADER_PACK_VERSION,
+        .entry_count = count,
+    };
+    fwrite(&header, sizeof(header), 1, out);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        fwrite(&modules[i].entry, sizeof(shader_pack_entry), 1, out);
+    }
+
+    static const char padding[SHADER_PACK_ALIGNMENT] = {0};
+    for (uint32_t i = 0; i < count; i++)
+    {
+        long position = ftell(out);
+        fwrite(padding, 1, modules[i].entry.offset - position, out);
+        fwrite(modules[i].data, 1, modules[i].entry.size, out);
+        free(modules[i].data);
+    }
+
+    if (ferror(out) || fclose(out) != 0)
+    {
+        die("could not write %s", tmp_path);
+    }
+    if (rename(tmp_path, argv[1]) != 0)
+    {
+        die("could not write %s", argv[1]);
+    }
+
+    printf("packed %u shader modules into %s (%llu bytes)\n", count, argv[1],
+           (unsigned long long)offset);
+    free(modules);
+    return 0;
+}